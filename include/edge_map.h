@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "image.h"
+
+// Binary edge map, one bit per pixel. Each row is words_per_row 64-bit
+// words, pixel x in bit x%64 of word x/64; the bits past w are always zero,
+// so that whole words can be combined without masking.
+class EdgeMap
+  {
+  public:
+      int w=0;
+      int h=0;
+      int words_per_row=0;
+      std::vector<uint64_t> data;
+
+      EdgeMap() = default;
+      EdgeMap(int w, int h) : w(w), h(h), words_per_row((w + 63) / 64), data(static_cast<size_t>(words_per_row) * h) {}
+
+      bool operator()(int x, int y) const
+        {
+        assert(x >= 0 && x < w && y >= 0 && y < h);
+        return (RowPtr(y)[x >> 6] >> (x & 63)) & 1;
+        }
+
+      void set(int x, int y, bool v)
+        {
+        assert(x >= 0 && x < w && y >= 0 && y < h);
+        uint64_t bit = uint64_t(1) << (x & 63);
+        uint64_t& word = RowPtr(y)[x >> 6];
+        word = v ? (word | bit) : (word & ~bit);
+        }
+
+      std::span<const uint64_t> RowPtr(int row) const { return std::span<const uint64_t>(data.data() + static_cast<size_t>(row) * words_per_row, words_per_row); }
+      std::span<      uint64_t> RowPtr(int row)       { return std::span<      uint64_t>(data.data() + static_cast<size_t>(row) * words_per_row, words_per_row); }
+
+      // resizes to w x h for the _into functions, the bits are unspecified afterwards
+      void reshape(int nw, int nh)
+        {
+        w = nw; h = nh; words_per_row = (w + 63) / 64;
+        data.resize(static_cast<size_t>(words_per_row) * h);
+        }
+
+      void clear(void) { std::fill(data.begin(), data.end(), 0); }
+
+      // number of edge pixels
+      size_t count(void) const;
+
+      bool operator==(const EdgeMap& other) const { return w == other.w && h == other.h && data == other.data; }
+  };
+
+// Sparse edges as a structure of arrays, in row-major order: the position,
+// gradient magnitude and direction sector (as in SectorImage) of each edge
+// pixel, so that consumers iterate over the edges rather than the pixels.
+struct EdgeList
+  {
+  std::vector<int32_t> x;
+  std::vector<int32_t> y;
+  std::vector<float> magnitude;
+  std::vector<uint8_t> sector;
+
+  size_t size(void) const { return x.size(); }
+  bool empty(void) const { return x.empty(); }
+
+  void reserve(size_t n) { x.reserve(n); y.reserve(n); magnitude.reserve(n); sector.reserve(n); }
+  void clear(void) { x.clear(); y.clear(); magnitude.clear(); sector.clear(); }
+
+  void push_back(int32_t px, int32_t py, float m, uint8_t s)
+    {
+    x.push_back(px); y.push_back(py); magnitude.push_back(m); sector.push_back(s);
+    }
+  };
+
+// Conversions from and to float images: non-zero pixels are edges, edges
+// become value
+EdgeMap to_edge_map(ConstImageView im);
+Image to_image(const EdgeMap& edges, float value=1.0f);
+
+// Run-length encoding of the pixels in row-major order: the lengths of the
+// alternating runs of non-edges and edges, starting with non-edges (possibly
+// an empty run), as LEB128 varints. It pays off over the 1 bit per pixel
+// when the runs are long on average, i.e. for sparse edges.
+std::vector<uint8_t> encode_rle(const EdgeMap& edges);
+EdgeMap decode_rle(std::span<const uint8_t> rle, int w, int h);
+
+// Edge map files: a small header (magic, version, encoding, w, h, payload
+// size) followed by the rows of bits or by the run-length encoding. Both
+// throw std::runtime_error on failure.
+enum class EdgeMapEncoding : uint32_t { Bits = 0, RLE = 1 };
+void save_edge_map(const EdgeMap& edges, const std::string& filename, EdgeMapEncoding encoding=EdgeMapEncoding::Bits);
+EdgeMap load_edge_map(const std::string& filename);
+
+// Edge stages writing bits directly, see image.h for the float versions.
+// double_thresholding_into sets the pixels >= high in strong and those in
+// [low, high) in weak. edge_tracking keeps the strong pixels and the weak
+// ones with a strong pixel among their 8 neighbours; from a thresholded float
+// image the pixels equal to strong and weak are taken.
+void double_thresholding_into(ConstImageView im, float lowThreshold, float highThreshold, EdgeMap& strong, EdgeMap& weak);
+EdgeMap edge_tracking(const EdgeMap& strong, const EdgeMap& weak);
+void edge_tracking_into(const EdgeMap& strong, const EdgeMap& weak, EdgeMap& out);
+void edge_tracking_into(ConstImageView im, float weak, float strong, EdgeMap& out);
+
+// Hysteresis straight into an edge list: the edges are appended to out (which
+// is cleared first) as each word of the result is tracked, the capacity being
+// reserved from the strong and weak counts. The magnitude is read from mag,
+// the gradient magnitude or the output of non-maximum suppression, which agree
+// on edges; the sector from dir, or rounded from the angles of a float image.
+void edge_tracking_into(const EdgeMap& strong, const EdgeMap& weak, ConstImageView mag, const SectorImage& dir, EdgeList& out);
+void edge_tracking_into(const EdgeMap& strong, const EdgeMap& weak, ConstImageView mag, ConstImageView dir, EdgeList& out);
+
+// canny() of a single channel image as an edge list, without a dense result
+EdgeList canny_edge_list(ConstImageView im, const CannyParams& params=CannyParams());
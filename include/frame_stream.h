@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "image.h"
+
+// Raw video frames through pipes. The input is either a sequence of binary
+// PNM images (P5 gray or P6 RGB, 8 or 16 bits, sizes may change from frame
+// to frame) or a YUV4MPEG2 stream (8-bit, any chroma subsampling), as
+// written by decoders such as "ffmpeg -f image2pipe" or "-f yuv4mpegpipe".
+// The output frames are P5 PGM, P4 PBM or a "Cmono" YUV4MPEG2 stream.
+enum class FrameFormat { PGM, PPM, PBM, Y4M };
+
+// Reads frames as one gray float plane in [0,1]: PGM and the Y4M luma plane
+// as stored, PPM with the luma of rgb_to_grayscale() (the same values as
+// rgb_to_grayscale(load_image()) for 8 bits). The buffers are kept from frame
+// to frame, so reading into the same Image allocates nothing once the size
+// is stable.
+class FrameReader
+  {
+  public:
+      // largest frame read, 16384 x 16384 pixels
+      static constexpr size_t MAX_PIXELS = size_t(1) << 28;
+
+      explicit FrameReader(FILE* in) : in(in) {}
+
+      // Reads the next frame into frame, reshaped only if its size differs.
+      // Returns false at the end of the stream, throws std::runtime_error on a
+      // malformed, unsupported, truncated or larger than MAX_PIXELS frame.
+      bool read(Image& frame);
+
+      FrameFormat format(void) const { return fmt; }              // of the last frame read
+      int frames(void) const { return count; }                    // frames read so far
+      const std::string& y4m_params(void) const { return params; } // F, A and I tags of a Y4M stream
+
+  private:
+      FILE* in;
+      FrameFormat fmt = FrameFormat::PGM;
+      int count = 0;
+
+      bool y4m = false;
+      int y4m_w = 0, y4m_h = 0;
+      size_t y4m_chroma = 0;                // bytes of chroma (and alpha) after each luma plane
+      std::string params;
+
+      int maxval = 0;
+      std::vector<float> values;            // sample v -> v / maxval
+      std::vector<unsigned char> bytes;
+
+      void read_y4m_header(void);
+      bool read_pnm(Image& frame, int magic);
+      bool read_y4m(Image& frame);
+  };
+
+// Writes edge frames: PGM and Y4M rounded to 8 bits as by save_image(), PBM
+// with the pixels >= 0.5 as 1 (drawn black by viewers). Each frame is flushed
+// so that the next program of the pipeline gets it right away. Throws
+// std::runtime_error if the output fails or, for Y4M, if the size changes.
+class FrameWriter
+  {
+  public:
+      FrameWriter(FILE* out, FrameFormat format, std::string y4m_params = "");
+
+      void write(ConstImageView frame);
+
+  private:
+      FILE* out;
+      FrameFormat fmt;
+      std::string params;
+      int y4m_w = -1, y4m_h = -1;
+      std::vector<unsigned char> bytes;
+  };
@@ -3,6 +3,7 @@
 #include <cassert>
 #include <cstring>
 #include <cmath>
+#include <cstdint>
 
 #include <algorithm>
 #include <string>
@@ -13,12 +14,15 @@
 using namespace std;
 
 #include "utils.h"
+#include "image_view.h"
+#include "padded_image.h"
 
 
 // DO NOT CHANGE THIS FILE
 
 
 class Image;
+template<typename E> struct ImageExpr;
 
 // DO NOT USE THE FOLLOWING FUNCTIONS DIRECTLY
 // These are just helper function that allow the Image struct to function properly
@@ -28,6 +32,21 @@ int pixel_address(const Image& im, int x, int y, int ch);  // access helper
 float get_clamped_pixel(const Image& im, int x, int y, int ch); // access with clamping
 void set_pixel(Image& im, int x, int y, int c, float value); // setting only in-bounds
 
+// Options of the PNG encoder of save_png(), see PngOptions below
+struct PngOptions;
+
+// Pixel access policies of Image::at(). The accessors of Image are inline so
+// that the hot loops can be vectorized; DebugAccess asserts the coordinates
+// (in builds without NDEBUG), UncheckedAccess never does. operator() uses
+// DefaultAccess, which is UncheckedAccess when SRIMG_UNCHECKED_ACCESS is defined.
+struct DebugAccess     { static constexpr bool checked = true;  };
+struct UncheckedAccess { static constexpr bool checked = false; };
+#ifdef SRIMG_UNCHECKED_ACCESS
+using DefaultAccess = UncheckedAccess;
+#else
+using DefaultAccess = DebugAccess;
+#endif
+
 
 
 class Image
@@ -43,42 +62,53 @@ class Image
       Image() = default;
       Image(int size) : data(size) {};
       Image(int w, int h, int c=1) : w(w), h(h), c(c), data(w*h*c) {}
+      // copy of the pixels of a view
+      explicit Image(ConstImageView v) : Image(v.w, v.h, v.c)
+        {
+        for(int ch=0;ch<c;ch++)for(int y=0;y<h;y++)
+          {
+          std::span<const float> src = v.RowPtr(y,ch);
+          std::copy(src.begin(), src.end(), RowPtr(y,ch).begin());
+          }
+        }
 
       Image(const Image& other) = default;
       Image& operator=(const Image& other) = default;
       Image(Image&& other) noexcept = default;
       Image& operator=(Image&& other) noexcept = default;
+      // evaluates an element-wise expression in place, see image_expr.h
+      template<typename E> Image& operator=(const ImageExpr<E>& e);
       ~Image() = default;
 
-      // pixel access
-      float& operator()(int x, int y, int ch)
-        {
-        check_bounds(x, y, ch);
-        return data[pixel_address(*this,x,y,ch)];
-        }
+      // pixel access, inline with the DefaultAccess policy
+      float& operator()(int x, int y, int ch)             { return at(x,y,ch); }
+      float& operator()(int x, int y)                     { return at(x,y,0); }
+      const float& operator()(int x, int y, int ch) const { return at(x,y,ch); }
+      const float& operator()(int x, int y) const         { return at(x,y,0); }
 
-      float& operator()(int x, int y)
-        {
-        check_bounds(x, y, 0);
-        return data[pixel_address(*this,x,y,0)];
-        }
+            float& pixel(int x, int y, int ch)       { return operator()(x,y,ch); }
+      const float& pixel(int x, int y, int ch) const { return operator()(x,y,ch); }
+            float& pixel(int x, int y)               { return operator()(x,y); }
+      const float& pixel(int x, int y) const         { return operator()(x,y); }
 
-      const float& operator()(int x, int y, int ch) const
+      // pixel access with an explicit policy: at<UncheckedAccess>(x,y,ch)
+      // never checks, at<DebugAccess>(x,y,ch) asserts the coordinates
+      template<typename Access=DefaultAccess>
+      float& at(int x, int y, int ch)
         {
-        check_bounds(x, y, ch);
-        return data[pixel_address(*this,x,y,ch)];
+        if constexpr (Access::checked) check_bounds(x, y, ch);
+        return data[index(x,y,ch)];
         }
 
-      const float& operator()(int x, int y) const
+      template<typename Access=DefaultAccess>
+      const float& at(int x, int y, int ch) const
         {
-        check_bounds(x, y, 0);
-        return data[pixel_address(*this,x,y,0)];
+        if constexpr (Access::checked) check_bounds(x, y, ch);
+        return data[index(x,y,ch)];
         }
 
-            float& pixel(int x, int y, int ch)       { return operator()(x,y,ch); }
-      const float& pixel(int x, int y, int ch) const { return operator()(x,y,ch); }
-            float& pixel(int x, int y)               { return operator()(x,y); }
-      const float& pixel(int x, int y) const         { return operator()(x,y); }
+      // same as pixel_address(), inline
+      size_t index(int x, int y, int ch) const { return (static_cast<size_t>(ch)*h + y)*w + x; }
 
   private:
 
@@ -94,17 +124,19 @@ class Image
        }
 
   public:
+      // same as get_clamped_pixel(), inline: the channel is clamped too
       float clamped_pixel(int x, int y, int ch) const
         {
-        //assert(ch<c && ch>=0);
-        check_bounds(ch);
-        return get_clamped_pixel(*this,x,y,ch);
+        ch = ch < 0 ? 0 : (ch >= c ? c - 1 : ch);
+        x = x < 0 ? 0 : (x >= w ? w - 1 : x);
+        y = y < 0 ? 0 : (y >= h ? h - 1 : y);
+        return data[index(x,y,ch)];
         }
 
       float clamped_pixel(int x, int y) const
         {
         assert(c==1);
-        return get_clamped_pixel(*this,x,y,0);
+        return clamped_pixel(x,y,0);
         }
 
       void set_pixel(int x, int y, int ch, float v)
@@ -119,6 +151,12 @@ class Image
       std::span<const float> RowPtr(int row, int channel) const {return std::span<const float>(data.data() + (channel * w * h) + (row * w), w);}
       std::span<      float> RowPtr(int row, int channel)       {return std::span<      float>(data.data() + (channel * w * h) + (row * w), w);}
 
+      // non-owning views of the whole image, see image_view.h
+      ImageView      view(void)       { return ImageView     (data.data(), w, h, c, w, w * h); }
+      ConstImageView view(void) const { return ConstImageView(data.data(), w, h, c, w, w * h); }
+      operator ImageView()            { return view(); }
+      operator ConstImageView() const { return view(); }
+
       bool contains(float x, float y) const { return x>-0.5f && x<w-0.5f && y>-0.5f && y<h-0.5f; }
 
       bool is_empty(int x, int y) const
@@ -141,6 +179,15 @@ class Image
 
       int size(void) const { return data.size(); }
 
+      // resizes to w x h x c for the _into functions, keeping the buffer when
+      // the size does not change; the pixel values are unspecified afterwards
+      void reshape(int nw, int nh, int nc)
+        {
+        if (nw == w && nh == h && nc == c) return;
+        w = nw; h = nh; c = nc;
+        data.resize(static_cast<size_t>(w) * h * c);
+        }
+
       void clear(void) {
         std::fill(data.begin(), data.end(), 0.0f);
       }
@@ -176,17 +223,62 @@ class Image
 
       void load_image  (const string& filename);
       void save_png    (string filename) const;
+      void save_png    (string filename, const PngOptions& options) const;
       void save_image  (string filename) const;
 
   };
 
+// Gradient direction rounded to the nearest multiple of PI/4 and folded modulo PI,
+// one byte per pixel: 0 = horizontal, 1 = diagonal, 2 = vertical, 3 = anti-diagonal
+struct SectorImage
+  {
+  int w=0;
+  int h=0;
+  std::vector<uint8_t> data;
+
+  SectorImage() = default;
+  SectorImage(int w, int h) : w(w), h(h), data(w*h) {}
+
+  void reshape(int nw, int nh) { w = nw; h = nh; data.resize(static_cast<size_t>(w) * h); }
+
+        uint8_t& operator()(int x, int y)       { assert(x>=0 && x<w && y>=0 && y<h); return data[y*w+x]; }
+  const uint8_t& operator()(int x, int y) const { assert(x>=0 && x<w && y>=0 && y<h); return data[y*w+x]; }
+
+  int size(void) const { return data.size(); }
+  };
+
+// PNG encoding. Bands of rows are filtered and deflated in parallel, each
+// band primed with the last 32 KB of the previous one and ended with a sync
+// flush, so that the bands concatenate into a single zlib stream.
+enum class PngFilter { None, Sub, Up, Average, Paeth, Adaptive };
+enum class PngFormat { Auto, Gray8, Gray1 };
+
+struct PngOptions
+  {
+  int compression = 3;                      // zlib level, 0 (stored) to 9
+  PngFilter filter = PngFilter::Adaptive;   // Adaptive: per row, the filter with the smallest sum of
+                                            // absolute differences, None for 1-bit images
+  PngFormat format = PngFormat::Auto;       // Auto: 8 bits per channel, all channels (1 to 4);
+                                            // Gray8, Gray1: the first channel only, Gray1 with bits set
+                                            // where the 8-bit value would be >= 128 (edge maps)
+  int rows_per_band = 0;                    // rows deflated together, 0 for about 256 KB per band
+  };
+
+// the bytes of the PNG file
+vector<unsigned char> encode_png(const Image& im, const PngOptions& options=PngOptions());
+
 // Image I/O functions
 inline Image load_binary (const string& filename) { Image im; im.load_binary(filename); return im; }
 inline Image load_image  (const string& filename) { Image im; im.load_image(filename);  return im; }
 inline void  save_png    (const Image& im, const string& filename) { im.save_png   (filename); }
+inline void  save_png    (const Image& im, const string& filename, const PngOptions& options) { im.save_png(filename, options); }
 inline void  save_image  (const Image& im, string filename) { im.save_image (filename); }
 inline void  save_binary (const Image& im, string filename) { im.save_binary(filename); }
 
+// Loads an image as a single gray plane without the color planes in between:
+// the same pixels as rgb_to_grayscale(load_image(filename)) for color images,
+// the first channel for gray ones
+Image load_image_gray(const string& filename);
 
 // Basic operations
 Image rgb_to_grayscale(const Image& im);
@@ -198,6 +290,7 @@ void rgb_to_lch(Image& im);
 void shift_image(Image& im, int c, float v);
 void scale_image(Image& im, int c, float v);
 void clamp_image(Image& im);
+Image clamp_image(Image&& im);   // in place, returns the input buffer
 
 // Image manipulation
 Image get_channel(const Image& im, int c);
@@ -207,39 +300,119 @@ int image_close_enough(const Image& a, const Image& b, float eps=1e-6);
 
 Image sub_image(const Image& a, const Image& b);
 Image add_image(const Image& a, const Image& b);
-Image operator-(const Image& a, const Image& b);
-Image operator+(const Image& a, const Image& b);
+// operator+, operator- and the rest of the element-wise arithmetic: image_expr.h
 
 // Resizing
 Image nearest_resize (const Image& im, int w, int h);
 Image bilinear_resize(const Image& im, int w, int h);
+void nearest_resize_into (const Image& im, int w, int h, Image& out);
+void bilinear_resize_into(const Image& im, int w, int h, Image& out);
+
+// The _into variants write their result into out, reshaped only if its size
+// differs, so that a frame loop can keep reusing the same buffers. Unless
+// stated otherwise out must not be the input image.
 
 // Filtering
-Image convolve_image(const Image& im, const Image& filter, bool preserve);
+Image convolve_image(ConstImageView im, const Image& filter, bool preserve);
+void convolve_image_into(ConstImageView im, const Image& filter, bool preserve, Image& out);
 Image convolve_image_fast(const Image& im, const Image& filter, bool preserve);
 Image make_box_filter(int w);
 Image make_highpass_filter(void);
 Image make_sharpen_filter(void);
 Image make_emboss_filter(void);
 Image make_gaussian_filter(float sigma);
+Image make_gaussian_filter_1d(float sigma);
 Image make_gx_filter(void);
 Image make_gy_filter(void);
 void feature_normalize(Image& im);
+Image feature_normalize(Image&& im);   // in place, returns the input buffer
 void feature_normalize_total(Image& im);
 
 void threshold_image(Image& im, float thresh);
-pair<Image,Image> sobel_image(const Image&  im);
+pair<Image,Image> sobel_image(ConstImageView im);
+void sobel_image_into(ConstImageView im, Image& mag, Image& dir);
 Image colorize_sobel(const Image&  im);
-Image smooth_image(const Image&  im, float sigma);
 Image bilateral_filter(const Image& im, float sigma1, float sigma2);
 Image bilateral_filter_fast(const Image &im, float sigma1, float sigma2);
 Image histogram_equalization_hsv(const Image& im, int num_bins);
 Image histogram_equalization_rgb(const Image& im, int num_bins);
 
 // Edge detection methods
-Image smooth_image(const Image& im, float sigma);
-pair<Image,Image> compute_gradient(const Image& im);
-Image non_maximum_suppression(const Image& mag, const Image& dir);
-Image double_thresholding(const Image& im, float lowThreshold, float highThreshold, float strongVal, float weakVal);
-Image edge_tracking(const Image& im, float weak, float strong);
+// How the thresholds of double_thresholding are chosen: given by the user,
+// or computed from the magnitudes after non-maximum suppression
+enum class ThresholdMethod { Manual, Median, Otsu };
+
+// Histogram of the non-zero magnitudes after non-maximum suppression, in [0,1]
+struct MagnitudeHistogram
+  {
+  static constexpr int BINS = 256;
+  std::vector<uint64_t> counts = std::vector<uint64_t>(BINS);
+  uint64_t total = 0;
+
+  static int bin(float v) { return std::min(BINS - 1, static_cast<int>(v * BINS)); }
+  void add(float v) { counts[bin(v)]++; total++; }
+  };
+
+struct CannyParams
+  {
+  float sigma = 1.4f;          // standard deviation of the smoothing Gaussian
+  float low = 0.03f;           // low threshold of double_thresholding (Manual only)
+  float high = 0.17f;          // high threshold of double_thresholding (Manual only)
+  ThresholdMethod thresholds = ThresholdMethod::Manual;
+  float strong = 1.0f;         // value of strong edges
+  float weak = 0.25f;          // value of weak edges
+  };
+
+// smooth_image() uses the separable filter for sigma < SMOOTH_RECURSIVE_SIGMA
+// and the recursive (IIR) one from there on
+constexpr float SMOOTH_RECURSIVE_SIGMA = 3.0f;
+
+Image smooth_image(ConstImageView im, float sigma);
+Image smooth_image_separable(ConstImageView im, float sigma);
+Image smooth_image_recursive(ConstImageView im, float sigma);
+Image smooth_image_recursive(Image&& im, float sigma);   // in place, returns the input buffer
+pair<Image,Image> compute_gradient(ConstImageView im);
+pair<Image,SectorImage> compute_gradient_sectors(ConstImageView im);
+Image non_maximum_suppression(ConstImageView mag, ConstImageView dir);
+Image non_maximum_suppression(ConstImageView mag, const SectorImage& dir);
+Image non_maximum_suppression(ConstImageView mag, ConstImageView dir, MagnitudeHistogram& hist);
+Image non_maximum_suppression(ConstImageView mag, const SectorImage& dir, MagnitudeHistogram& hist);
+Image non_maximum_suppression(const PaddedImage& mag, const SectorImage& dir);
+Image non_maximum_suppression(const PaddedImage& mag, const SectorImage& dir, MagnitudeHistogram& hist);
+pair<float,float> auto_thresholds(const MagnitudeHistogram& hist, ThresholdMethod method);
+Image double_thresholding(ConstImageView im, float lowThreshold, float highThreshold, float strongVal, float weakVal);
+Image double_thresholding(Image&& im, float lowThreshold, float highThreshold, float strongVal, float weakVal);   // in place
+Image edge_tracking(ConstImageView im, float weak, float strong);
+Image edge_tracking_connected(ConstImageView im, float weak, float strong, int threads=0);
+Image canny_fused(ConstImageView im, const CannyParams& params=CannyParams());
+
+void smooth_image_into(ConstImageView im, float sigma, Image& out);
+void smooth_image_separable_into(ConstImageView im, float sigma, Image& out);
+void smooth_image_recursive_into(ConstImageView im, float sigma, Image& out);   // out may be the input
+void compute_gradient_into(ConstImageView im, Image& mag, Image& dir);
+void compute_gradient_sectors_into(ConstImageView im, Image& mag, SectorImage& dir);
+void non_maximum_suppression_into(ConstImageView mag, ConstImageView dir, Image& out);
+void non_maximum_suppression_into(ConstImageView mag, const SectorImage& dir, Image& out);
+void non_maximum_suppression_into(ConstImageView mag, ConstImageView dir, MagnitudeHistogram& hist, Image& out);
+void non_maximum_suppression_into(ConstImageView mag, const SectorImage& dir, MagnitudeHistogram& hist, Image& out);
+void non_maximum_suppression_into(const PaddedImage& mag, const SectorImage& dir, Image& out);
+void non_maximum_suppression_into(const PaddedImage& mag, const SectorImage& dir, MagnitudeHistogram& hist, Image& out);
+void double_thresholding_into(ConstImageView im, float lowThreshold, float highThreshold, float strongVal, float weakVal, Image& out);   // out may be the input
+void edge_tracking_into(ConstImageView im, float weak, float strong, Image& out);
+void edge_tracking_connected_into(ConstImageView im, float weak, float strong, Image& out, int threads=0);
+void canny_fused_into(ConstImageView im, const CannyParams& params, Image& out);
+
+// Batch processing
+struct BatchStats
+  {
+  int images = 0;                 // edge maps written
+  int failed = 0;                 // images that could not be read or written
+  vector<string> failed_paths;
+  double seconds = 0;             // wall-clock time of the whole batch
+  double images_per_second = 0;
+  };
+
+BatchStats canny_batch(const vector<string>& paths, const CannyParams& params, const string& out_dir, int workers=0);
 
+// element-wise arithmetic on Images (operator+, operator-, ...)
+#include "image_expr.h"
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <type_traits>
+
+#include "image.h"
+#include "image_pool.h"
+#include "parallel.h"
+
+// Expression templates for element-wise image arithmetic. Operators on
+// Images, expressions and scalars build a tree of small nodes instead of
+// computing intermediate Images; the tree is evaluated in one fused loop
+// when it is assigned to an Image, e.g.
+//     Image r = clamp((a - b) * 0.5f + c);
+// reads a, b and c once and writes r once. The nodes refer to the Images
+// they were built from, so an expression must be evaluated before those
+// Images are destroyed (do not store expressions in `auto` variables
+// beyond the statement that uses them). All images of an expression must
+// have the same size; scalars are broadcast.
+
+// Base of the expression nodes: E provides w, h, c (-1 for scalars) and
+// operator[](i), the value of the i-th element in the order of Image::data
+template<typename E>
+struct ImageExpr
+  {
+  const E& self(void) const { return static_cast<const E&>(*this); }
+
+  // evaluation into a new Image (taken from the image pool, if any)
+  operator Image() const;
+  };
+
+// Pixels of an Image, or of a contiguous view
+struct ImageLeaf : ImageExpr<ImageLeaf>
+  {
+  const float* p;
+  int w, h, c;
+
+  explicit ImageLeaf(ConstImageView v) : p(v.ptr), w(v.w), h(v.h), c(v.c) { assert(v.is_contiguous()); }
+  float operator[](size_t i) const { return p[i]; }
+  };
+
+// A constant, broadcast to every element
+struct ScalarLeaf : ImageExpr<ScalarLeaf>
+  {
+  float v;
+  int w = -1, h = -1, c = -1;
+
+  explicit ScalarLeaf(float v) : v(v) {}
+  float operator[](size_t) const { return v; }
+  };
+
+template<typename L, typename R, typename Op>
+struct BinaryExpr : ImageExpr<BinaryExpr<L, R, Op>>
+  {
+  L l;
+  R r;
+  int w, h, c;
+
+  BinaryExpr(const L& l, const R& r) : l(l), r(r), w(l.w >= 0 ? l.w : r.w), h(l.w >= 0 ? l.h : r.h), c(l.w >= 0 ? l.c : r.c)
+    {
+    assert((l.w < 0 || r.w < 0 || (l.w == r.w && l.h == r.h && l.c == r.c)) && "images of different sizes");
+    }
+  float operator[](size_t i) const { return Op::apply(l[i], r[i]); }
+  };
+
+template<typename A, typename Op>
+struct UnaryExpr : ImageExpr<UnaryExpr<A, Op>>
+  {
+  A a;
+  Op op;
+  int w, h, c;
+
+  UnaryExpr(const A& a, const Op& op) : a(a), op(op), w(a.w), h(a.h), c(a.c) {}
+  float operator[](size_t i) const { return op(a[i]); }
+  };
+
+struct AddOp { static float apply(float a, float b) { return a + b; } };
+struct SubOp { static float apply(float a, float b) { return a - b; } };
+struct MulOp { static float apply(float a, float b) { return a * b; } };
+struct DivOp { static float apply(float a, float b) { return a / b; } };
+struct MinOp { static float apply(float a, float b) { return b < a ? b : a; } };
+struct MaxOp { static float apply(float a, float b) { return a < b ? b : a; } };
+
+struct NegOp { float operator()(float a) const { return -a; } };
+struct AbsOp { float operator()(float a) const { return fabsf(a); } };
+// same comparisons as clamp_image(): NaN stays NaN
+struct ClampOp
+  {
+  float lo, hi;
+  float operator()(float a) const { return a > hi ? hi : (a < lo ? lo : a); }
+  };
+
+// Operands: Images and expressions, and scalars next to at least one of them
+template<typename T>
+constexpr bool is_image_operand = std::is_same_v<std::decay_t<T>, Image> || std::is_base_of_v<ImageExpr<std::decay_t<T>>, std::decay_t<T>>;
+
+template<typename T>
+constexpr bool is_expr_operand = is_image_operand<T> || std::is_arithmetic_v<std::decay_t<T>>;
+
+template<typename T>
+auto expr_operand(const T& x)
+  {
+  if constexpr (std::is_same_v<T, Image>) return ImageLeaf(x.view());
+  else if constexpr (std::is_arithmetic_v<T>) return ScalarLeaf(static_cast<float>(x));
+  else return x;
+  }
+
+// a contiguous view (a whole image or a single channel) as an expression
+inline ImageLeaf expr(ConstImageView v) { return ImageLeaf(v); }
+
+#define SRIMG_IMAGE_EXPR_BINARY(NAME, OP)                                                          \
+  template<typename L, typename R>                                                                 \
+    requires (is_expr_operand<L> && is_expr_operand<R> && (is_image_operand<L> || is_image_operand<R>)) \
+  auto NAME(const L& l, const R& r)                                                                \
+    {                                                                                              \
+    return BinaryExpr<decltype(expr_operand(l)), decltype(expr_operand(r)), OP>(expr_operand(l), expr_operand(r)); \
+    }
+
+SRIMG_IMAGE_EXPR_BINARY(operator+, AddOp)
+SRIMG_IMAGE_EXPR_BINARY(operator-, SubOp)
+SRIMG_IMAGE_EXPR_BINARY(operator*, MulOp)
+SRIMG_IMAGE_EXPR_BINARY(operator/, DivOp)
+SRIMG_IMAGE_EXPR_BINARY(min, MinOp)
+SRIMG_IMAGE_EXPR_BINARY(max, MaxOp)
+
+#undef SRIMG_IMAGE_EXPR_BINARY
+
+// With two operands of the same type, std::min and std::max (visible through
+// image.h's using namespace std) are as specialized as the templates above:
+// these overloads are more constrained, so that min(a, b) of two Images or two
+// identical expressions is still element-wise
+template<typename T> requires is_image_operand<T>
+auto min(const T& l, const T& r) { return BinaryExpr<decltype(expr_operand(l)), decltype(expr_operand(r)), MinOp>(expr_operand(l), expr_operand(r)); }
+
+template<typename T> requires is_image_operand<T>
+auto max(const T& l, const T& r) { return BinaryExpr<decltype(expr_operand(l)), decltype(expr_operand(r)), MaxOp>(expr_operand(l), expr_operand(r)); }
+
+template<typename A> requires is_image_operand<A>
+auto operator-(const A& a) { return UnaryExpr<decltype(expr_operand(a)), NegOp>(expr_operand(a), NegOp()); }
+
+template<typename A> requires is_image_operand<A>
+auto abs(const A& a) { return UnaryExpr<decltype(expr_operand(a)), AbsOp>(expr_operand(a), AbsOp()); }
+
+template<typename A> requires is_image_operand<A>
+auto clamp(const A& a, float lo=0.0f, float hi=1.0f) { return UnaryExpr<decltype(expr_operand(a)), ClampOp>(expr_operand(a), ClampOp{lo, hi}); }
+
+// Evaluates e into the contiguous view dst, of the same size, in one pass.
+// dst may be one of the operands: every element only depends on the
+// elements of the operands at the same index.
+template<typename E>
+void assign(ImageView dst, const ImageExpr<E>& e)
+  {
+  const E& x = e.self();
+  assert(dst.is_contiguous());
+  assert((x.w < 0 || (x.w == dst.w && x.h == dst.h && x.c == dst.c)) && "images of different sizes");
+  float* out = dst.ptr;
+  parallel_for(dst.size(), [&](int i0, int i1) {
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC ivdep
+#endif
+    for (int i = i0; i < i1; ++i) out[i] = x[i];
+  }, TILE_W * TILE_H);
+  }
+
+template<typename E>
+ImageExpr<E>::operator Image() const
+  {
+  const E& x = self();
+  Image res = acquire_image(x.w, x.h, x.c);
+  assign(res.view(), *this);
+  return res;
+  }
+
+template<typename E>
+Image& Image::operator=(const ImageExpr<E>& e)
+  {
+  const E& x = e.self();
+  // if the size changes, the operands cannot be this image
+  reshape(x.w, x.h, x.c);
+  assign(view(), e);
+  return *this;
+  }
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "image.h"
+
+struct ImagePoolStats
+  {
+  uint64_t hits = 0;      // acquisitions served from a recycled buffer
+  uint64_t misses = 0;    // acquisitions that had to allocate
+  size_t buffers = 0;     // buffers currently held by the pool
+  size_t bytes = 0;       // bytes currently held by the pool
+  };
+
+// Recycles the pixel buffers of Images (and PaddedImages) with the same
+// dimensions. Buffers handed out by acquire() are not cleared: they hold the
+// pixels of their previous use, so callers must write every pixel. Released
+// buffers beyond max_bytes are freed. Thread-safe.
+class ImagePool
+  {
+  public:
+      static constexpr size_t DEFAULT_MAX_BYTES = size_t(256) << 20;
+
+      explicit ImagePool(size_t max_bytes=DEFAULT_MAX_BYTES) : max_bytes(max_bytes) {}
+      ImagePool(const ImagePool&) = delete;
+      ImagePool& operator=(const ImagePool&) = delete;
+
+      Image acquire(int w, int h, int c=1);
+      PaddedImage acquire_padded(int w, int h, int c, int border);
+      void release(Image&& im);
+      void release(PaddedImage&& im);
+
+      ImagePoolStats stats(void) const;
+      void clear(void);
+
+  private:
+      mutable std::mutex mutex;
+      size_t max_bytes;
+      size_t bytes = 0;
+      uint64_t hits = 0;
+      uint64_t misses = 0;
+      std::map<std::array<int,3>, std::vector<std::vector<float>>> images;
+      std::map<std::array<int,4>, std::vector<PaddedImage>> padded;
+  };
+
+// Owns an Image and gives its buffer back to the pool when destroyed
+class PooledImage
+  {
+  public:
+      PooledImage(ImagePool& pool, int w, int h, int c=1) : pool(&pool), im(pool.acquire(w, h, c)) {}
+      PooledImage(ImagePool& pool, Image&& im) : pool(&pool), im(std::move(im)) {}
+      PooledImage(PooledImage&& other) noexcept : pool(other.pool), im(std::move(other.im)) { other.pool = nullptr; }
+      PooledImage& operator=(PooledImage&& other) noexcept
+        {
+        if (this != &other) { reset(); pool = other.pool; im = std::move(other.im); other.pool = nullptr; }
+        return *this;
+        }
+      PooledImage(const PooledImage&) = delete;
+      PooledImage& operator=(const PooledImage&) = delete;
+      ~PooledImage() { reset(); }
+
+            Image& operator*()        { return im; }
+      const Image& operator*()  const { return im; }
+            Image* operator->()       { return &im; }
+      const Image* operator->() const { return &im; }
+
+  private:
+      ImagePool* pool;
+      Image im;
+
+      void reset(void) { if (pool) pool->release(std::move(im)); pool = nullptr; }
+  };
+
+// Pool from which the filters and the edge detection stages take their
+// outputs and temporaries, none by default (plain allocations). Must not be
+// called while a filter is running; the pool must outlive its use.
+void set_image_pool(ImagePool* pool);
+ImagePool* get_image_pool(void);
+
+// Allocation helpers of the stages: through the current pool if any.
+// Without a pool acquire_image() returns a zeroed image, with one the pixels are unspecified.
+Image acquire_image(int w, int h, int c=1);
+PaddedImage acquire_padded_image(int w, int h, int c, int border);
+void release_image(Image&& im);
+void release_image(PaddedImage&& im);
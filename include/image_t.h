@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "image.h"
+
+// Planar (CHW) image with pixels of type T. Image stays the float image of
+// the rest of the library; ImageT holds the narrower types, u8 and u16
+// with values in [0,255] and [0,65535] standing for [0,1], and int16 for
+// signed intermediate results such as Sobel responses.
+template<typename T>
+class ImageT
+  {
+  public:
+      using value_type = T;
+
+      int w=0;
+      int h=0;
+      int c=0;
+      std::vector<T> data;
+
+      ImageT() = default;
+      ImageT(int w, int h, int c=1) : w(w), h(h), c(c), data(static_cast<size_t>(w)*h*c) {}
+
+            T& operator()(int x, int y, int ch)       { check_bounds(x, y, ch); return data[index(x, y, ch)]; }
+      const T& operator()(int x, int y, int ch) const { check_bounds(x, y, ch); return data[index(x, y, ch)]; }
+            T& operator()(int x, int y)               { return operator()(x, y, 0); }
+      const T& operator()(int x, int y) const         { return operator()(x, y, 0); }
+
+      std::span<const T> RowPtr(int row, int channel) const { return std::span<const T>(data.data() + index(0, row, channel), w); }
+      std::span<      T> RowPtr(int row, int channel)       { return std::span<      T>(data.data() + index(0, row, channel), w); }
+
+      BasicImageView<      T> view(void)       { return BasicImageView<      T>(data.data(), w, h, c, w, static_cast<ptrdiff_t>(w) * h); }
+      BasicImageView<const T> view(void) const { return BasicImageView<const T>(data.data(), w, h, c, w, static_cast<ptrdiff_t>(w) * h); }
+
+      int size(void) const { return data.size(); }
+
+  private:
+      size_t index(int x, int y, int ch) const { return (static_cast<size_t>(ch) * h + y) * w + x; }
+
+      void check_bounds(int x, int y, int ch) const
+        {
+        assert(ch < c && ch >= 0 && "Channel out of bounds");
+        assert(x < w && x >= 0 && "X-coordinate out of bounds");
+        assert(y < h && y >= 0 && "Y-coordinate out of bounds");
+        }
+  };
+
+using ImageU8  = ImageT<uint8_t>;
+using ImageU16 = ImageT<uint16_t>;
+using ImageS16 = ImageT<int16_t>;
+using ImageF32 = ImageT<float>;
+
+// Value standing for 1.0: 255 for u8, 65535 for u16, 1 for floating point
+template<typename T>
+constexpr float pixel_scale(void)
+  {
+  if constexpr (std::is_floating_point_v<T>) return 1.0f;
+  else return static_cast<float>(std::numeric_limits<T>::max());
+  }
+
+// One pixel from type From to type To: rescaled, then rounded half away from
+// zero and saturated for integer types, as when saving an 8-bit image
+template<typename To, typename From>
+inline To convert_pixel(From v)
+  {
+  if constexpr (std::is_same_v<To, From>) return v;
+  else if constexpr (std::is_floating_point_v<To>) return static_cast<To>(static_cast<float>(v) / pixel_scale<From>());
+  else
+    {
+    float s = std::roundf(static_cast<float>(v) * (pixel_scale<To>() / pixel_scale<From>()));
+    constexpr float lo = static_cast<float>(std::numeric_limits<To>::min());
+    constexpr float hi = static_cast<float>(std::numeric_limits<To>::max());
+    return static_cast<To>(s < lo ? lo : (s > hi ? hi : s));
+    }
+  }
+
+// Converts the pixels of a view, row by row (views may be strided)
+template<typename To, typename From>
+ImageT<To> convert_image(BasicImageView<const From> im)
+  {
+  ImageT<To> res(im.w, im.h, im.c);
+  for (int k = 0; k < im.c; ++k)
+    for (int y = 0; y < im.h; ++y)
+      {
+      const From* in = im.RowPtr(y, k).data();
+      To* out = res.RowPtr(y, k).data();
+      for (int x = 0; x < im.w; ++x) out[x] = convert_pixel<To>(in[x]);
+      }
+  return res;
+  }
+
+template<typename To, typename From>
+ImageT<To> convert_image(const ImageT<From>& im) { return convert_image<To, From>(im.view()); }
+
+template<typename To>
+ImageT<To> convert_image(ConstImageView im) { return convert_image<To, float>(im); }
+
+// Back to a float Image with values in [0,1]
+template<typename T>
+Image to_image(const ImageT<T>& im)
+  {
+  Image res(im.w, im.h, im.c);
+  for (size_t i = 0; i < im.data.size(); ++i) res.data[i] = convert_pixel<float>(im.data[i]);
+  return res;
+  }
+
+// Loads an image as 8-bit pixels, without going through float
+ImageU8 load_image_u8(const string& filename);
+// load_image_gray() in 8 bits, the pixels of convert_image<uint8_t>() of its result
+ImageU8 load_image_gray_u8(const string& filename);
+
+// Canny stages on narrow types: smoothing in u8 with 16-bit fixed-point
+// weights, Sobel in int16 (exact, the filters of make_gx_filter() and
+// make_gy_filter() times 8), then the float stages from the magnitude on
+ImageU8 smooth_image(const ImageU8& im, float sigma);
+pair<ImageS16,ImageS16> sobel_image_s16(const ImageU8& im);
+pair<Image,SectorImage> compute_gradient_sectors(const ImageU8& im);
+Image canny_u8(const ImageU8& im, const CannyParams& params=CannyParams());
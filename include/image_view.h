@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <span>
+#include <type_traits>
+
+// Non-owning view of planar float pixels: w x h pixels of c channels, rows
+// `stride` floats apart and channels `plane` floats apart. A view of a whole
+// Image has stride w and plane w*h; roi() and channel() select part of it
+// without copying, so that filters and tile workers read the parent buffer.
+// T is float or const float (see ImageView and ConstImageView).
+template<typename T>
+class BasicImageView
+  {
+  public:
+      T* ptr=nullptr;
+      int w=0;
+      int h=0;
+      int c=0;
+      ptrdiff_t stride=0;
+      ptrdiff_t plane=0;
+
+      BasicImageView() = default;
+      BasicImageView(T* ptr, int w, int h, int c, ptrdiff_t stride, ptrdiff_t plane)
+        : ptr(ptr), w(w), h(h), c(c), stride(stride), plane(plane) {}
+
+      // an ImageView converts to a ConstImageView
+      template<typename U> requires (!std::is_same_v<U, T> && std::is_convertible_v<U*, T*>)
+      BasicImageView(const BasicImageView<U>& o) : BasicImageView(o.ptr, o.w, o.h, o.c, o.stride, o.plane) {}
+
+      std::span<T> RowPtr(int row, int channel) const
+        {
+        assert(row >= 0 && row < h && channel >= 0 && channel < c);
+        return std::span<T>(ptr + channel * plane + row * stride, w);
+        }
+
+      T& operator()(int x, int y, int ch) const
+        {
+        assert(x >= 0 && x < w && y >= 0 && y < h && ch >= 0 && ch < c);
+        return ptr[ch * plane + y * stride + x];
+        }
+      T& operator()(int x, int y) const { return operator()(x, y, 0); }
+
+      float clamped_pixel(int x, int y, int ch) const
+        {
+        x = x < 0 ? 0 : (x >= w ? w - 1 : x);
+        y = y < 0 ? 0 : (y >= h ? h - 1 : y);
+        return operator()(x, y, ch);
+        }
+      float clamped_pixel(int x, int y) const { assert(c == 1); return clamped_pixel(x, y, 0); }
+
+      // the rectangle [x, x+rw) x [y, y+rh) of all channels
+      BasicImageView roi(int x, int y, int rw, int rh) const
+        {
+        assert(x >= 0 && y >= 0 && rw >= 0 && rh >= 0 && x + rw <= w && y + rh <= h);
+        return BasicImageView(ptr + y * stride + x, rw, rh, c, stride, plane);
+        }
+
+      // the single channel ch
+      BasicImageView channel(int ch) const
+        {
+        assert(ch >= 0 && ch < c);
+        return BasicImageView(ptr + ch * plane, w, h, 1, stride, plane);
+        }
+
+      int size(void) const { return w * h * c; }
+
+      // rows and planes follow each other without gaps, as in an Image
+      bool is_contiguous(void) const { return stride == w && (c <= 1 || plane == static_cast<ptrdiff_t>(w) * h); }
+  };
+
+using ImageView = BasicImageView<float>;
+using ConstImageView = BasicImageView<const float>;
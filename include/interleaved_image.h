@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "image.h"
+#include "image_t.h"
+
+// Image stored interleaved (HWC): the c channels of a pixel are contiguous
+// and rows are w*c values long, as in the buffers of image codecs. Loading
+// and saving are straight copies, and per-pixel colour conversions read one
+// contiguous pixel. T is the pixel type, as in ImageT.
+template<typename T>
+class InterleavedImageT
+  {
+  public:
+      using value_type = T;
+
+      int w=0;
+      int h=0;
+      int c=0;
+      std::vector<T> data;
+
+      InterleavedImageT() = default;
+      InterleavedImageT(int w, int h, int c=1) : w(w), h(h), c(c), data(static_cast<size_t>(w)*h*c) {}
+
+            T& operator()(int x, int y, int ch)       { check_bounds(x, y, ch); return data[index(x, y) + ch]; }
+      const T& operator()(int x, int y, int ch) const { check_bounds(x, y, ch); return data[index(x, y) + ch]; }
+
+      // the c channels of pixel (x,y)
+      std::span<const T> PixelPtr(int x, int y) const { check_bounds(x, y, 0); return std::span<const T>(data.data() + index(x, y), c); }
+      std::span<      T> PixelPtr(int x, int y)       { check_bounds(x, y, 0); return std::span<      T>(data.data() + index(x, y), c); }
+
+      // row `row`, w*c values
+      std::span<const T> RowPtr(int row) const { return std::span<const T>(data.data() + index(0, row), static_cast<size_t>(w) * c); }
+      std::span<      T> RowPtr(int row)       { return std::span<      T>(data.data() + index(0, row), static_cast<size_t>(w) * c); }
+
+      int size(void) const { return data.size(); }
+
+  private:
+      size_t index(int x, int y) const { return (static_cast<size_t>(y) * w + x) * c; }
+
+      void check_bounds(int x, int y, int ch) const
+        {
+        assert(ch < c && ch >= 0 && "Channel out of bounds");
+        assert(x < w && x >= 0 && "X-coordinate out of bounds");
+        assert(y < h && y >= 0 && "Y-coordinate out of bounds");
+        }
+  };
+
+using InterleavedImage   = InterleavedImageT<float>;
+using InterleavedImageU8 = InterleavedImageT<uint8_t>;
+
+// Layout conversions, with the pixel conversion of convert_pixel()
+template<typename To=float, typename From>
+ImageT<To> to_planar(const InterleavedImageT<From>& im)
+  {
+  ImageT<To> res(im.w, im.h, im.c);
+  for (int k = 0; k < im.c; ++k)
+    for (int y = 0; y < im.h; ++y)
+      {
+      const From* in = im.RowPtr(y).data() + k;
+      To* out = res.RowPtr(y, k).data();
+      for (int x = 0; x < im.w; ++x) out[x] = convert_pixel<To>(in[x * im.c]);
+      }
+  return res;
+  }
+
+template<typename To=float, typename From>
+InterleavedImageT<To> to_interleaved(BasicImageView<const From> im)
+  {
+  InterleavedImageT<To> res(im.w, im.h, im.c);
+  for (int k = 0; k < im.c; ++k)
+    for (int y = 0; y < im.h; ++y)
+      {
+      const From* in = im.RowPtr(y, k).data();
+      To* out = res.RowPtr(y).data() + k;
+      for (int x = 0; x < im.w; ++x) out[x * im.c] = convert_pixel<To>(in[x]);
+      }
+  return res;
+  }
+
+template<typename To=float>
+InterleavedImageT<To> to_interleaved(ConstImageView im) { return to_interleaved<To, float>(im); }
+
+// Pixel type conversion keeping the layout
+template<typename To, typename From>
+InterleavedImageT<To> convert_image(const InterleavedImageT<From>& im)
+  {
+  InterleavedImageT<To> res(im.w, im.h, im.c);
+  for (size_t i = 0; i < im.data.size(); ++i) res.data[i] = convert_pixel<To>(im.data[i]);
+  return res;
+  }
+
+// Image I/O without transposition (alpha channels are dropped, as in load_image())
+InterleavedImageU8 load_image_interleaved_u8(const string& filename);
+InterleavedImage   load_image_interleaved(const string& filename);
+void save_image_interleaved(const InterleavedImageU8& im, string filename, bool is_png=true);
+void save_image_interleaved(const InterleavedImage& im, string filename, bool is_png=true);
+
+// Colour conversions of 3-channel interleaved images, in place
+void rgb_to_hsv(InterleavedImage& im);
+void hsv_to_rgb(InterleavedImage& im);
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "image.h"
+#include "image_t.h"
+
+// On-disk image format that can be memory-mapped and read in place.
+// A 128-byte header is followed by the planar pixels: each row is padded to a
+// multiple of 64 bytes (stride pixels), each channel holds h rows (plane
+// pixels), and the pixels start at data_offset, a multiple of 64. The checksum
+// is a Fletcher-64 of the whole payload, padding included.
+enum class PixelType : uint32_t { F32 = 1, U8 = 2, U16 = 3, S16 = 4 };
+
+template<typename T> constexpr PixelType pixel_type_of(void);
+template<> constexpr PixelType pixel_type_of<float>(void)    { return PixelType::F32; }
+template<> constexpr PixelType pixel_type_of<uint8_t>(void)  { return PixelType::U8; }
+template<> constexpr PixelType pixel_type_of<uint16_t>(void) { return PixelType::U16; }
+template<> constexpr PixelType pixel_type_of<int16_t>(void)  { return PixelType::S16; }
+
+struct MappedImageHeader
+  {
+  static constexpr char MAGIC[8] = {'S', 'R', 'I', 'M', 'G', '\r', '\n', '\x1a'};
+  static constexpr uint32_t VERSION = 1;
+  static constexpr size_t ALIGNMENT = 64;
+
+  char magic[8];
+  uint32_t version;
+  PixelType type;
+  int32_t w, h, c;
+  uint32_t reserved;
+  uint64_t stride;        // pixels between the starts of two rows
+  uint64_t plane;         // pixels between the starts of two channels
+  uint64_t data_offset;   // bytes from the start of the file to the pixels
+  uint64_t data_bytes;    // bytes of pixels, plane * c * pixel size
+  uint64_t checksum;      // Fletcher-64 of the data_bytes bytes of pixels
+  unsigned char padding[56];
+  };
+static_assert(sizeof(MappedImageHeader) % MappedImageHeader::ALIGNMENT == 0);
+
+// Writes an image in the mapped format. The file is written under a temporary
+// name and renamed, so that readers never map a partial file. Throws
+// std::runtime_error if it cannot be written.
+template<typename T>
+void save_mapped_image(BasicImageView<const T> im, const std::string& filename);
+
+inline void save_mapped_image(const Image& im, const std::string& filename) { save_mapped_image<float>(im.view(), filename); }
+
+template<typename T>
+void save_mapped_image(const ImageT<T>& im, const std::string& filename) { save_mapped_image<T>(im.view(), filename); }
+
+// Read-only memory mapping of a file written by save_mapped_image(). Opening
+// checks the header only, so that it costs the same whatever the image size;
+// verify() reads the whole payload and checks the checksum. The views point
+// into the mapping and are valid as long as the MappedImage is.
+class MappedImage
+  {
+  public:
+      MappedImage() = default;
+      // throws std::runtime_error if the file cannot be mapped, its header is
+      // invalid or, with verify_checksum, the pixels do not match the checksum
+      explicit MappedImage(const std::string& filename, bool verify_checksum=false);
+      MappedImage(MappedImage&& other) noexcept;
+      MappedImage& operator=(MappedImage&& other) noexcept;
+      MappedImage(const MappedImage&) = delete;
+      MappedImage& operator=(const MappedImage&) = delete;
+      ~MappedImage();
+
+      bool is_open(void) const { return header != nullptr; }
+      const MappedImageHeader& info(void) const { assert(header); return *header; }
+      int w(void) const { return info().w; }
+      int h(void) const { return info().h; }
+      int c(void) const { return info().c; }
+      PixelType type(void) const { return info().type; }
+
+      // view of the pixels, T must match type()
+      template<typename T>
+      BasicImageView<const T> view(void) const
+        {
+        if (pixel_type_of<T>() != type()) throw std::runtime_error("Pixel type mismatch in mapped image");
+        const MappedImageHeader& hd = info();
+        return BasicImageView<const T>(reinterpret_cast<const T*>(base + hd.data_offset), hd.w, hd.h, hd.c,
+                                       static_cast<ptrdiff_t>(hd.stride), static_cast<ptrdiff_t>(hd.plane));
+        }
+      operator ConstImageView() const { return view<float>(); }
+
+      bool verify(void) const;
+
+  private:
+      const unsigned char* base = nullptr;
+      size_t length = 0;
+      const MappedImageHeader* header = nullptr;
+
+      void unmap(void);
+  };
+
+inline MappedImage map_image(const std::string& filename, bool verify_checksum=false) { return MappedImage(filename, verify_checksum); }
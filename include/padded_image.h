@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "image_view.h"
+
+class Image;
+
+// Allocator returning memory aligned to Alignment bytes
+template<typename T, size_t Alignment>
+struct AlignedAllocator
+  {
+  using value_type = T;
+  template<typename U> struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+  AlignedAllocator() = default;
+  template<typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+  T* allocate(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment))); }
+  void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t(Alignment)); }
+
+  template<typename U> bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+  template<typename U> bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+  };
+
+// How the halo of a PaddedImage is filled
+//   Replicate: aaa|abcd|ddd, the same as clamped_pixel()
+//   Reflect:   cb|abcd|cb, mirrored around the border pixel
+enum class BorderMode { Replicate, Reflect };
+
+// Planar image surrounded by a halo of `border` pixels on every side, with
+// rows starting on 64-byte boundaries. Inside a neighbourhood of radius
+// `border` every pixel can be read with plain pointer offsets from RowPtr(),
+// so the inner loops of filters need no clamping and vectorize cleanly.
+class PaddedImage
+  {
+  public:
+      static constexpr int ALIGNMENT = 64;                          // bytes
+      static constexpr int ALIGN_FLOATS = ALIGNMENT / sizeof(float);
+
+      int w=0;
+      int h=0;
+      int c=0;
+      int border=0;
+      int stride=0;        // floats between two rows
+      std::vector<float, AlignedAllocator<float, ALIGNMENT>> data;
+
+      PaddedImage() = default;
+      PaddedImage(int w, int h, int c, int border);
+      // copy of im with the halo filled according to mode
+      PaddedImage(ConstImageView im, int border, BorderMode mode=BorderMode::Replicate);
+
+      // row `row` of channel `channel`, w pixels starting at x=0;
+      // rows -border..h+border-1 exist, and RowPtr(y,ch).data()[x] is valid for x in [-border, w+border)
+      std::span<const float> RowPtr(int row, int channel) const { return std::span<const float>(row_start(row, channel), w); }
+      std::span<      float> RowPtr(int row, int channel)       { return std::span<      float>(row_start(row, channel), w); }
+
+            float& operator()(int x, int y, int ch)       { return row_start(y, ch)[x]; }
+      const float& operator()(int x, int y, int ch) const { return row_start(y, ch)[x]; }
+
+      // view of the interior
+      ImageView      view(void)       { return h && c ? ImageView     (row_start(0, 0), w, h, c, stride, plane) : ImageView(); }
+      ConstImageView view(void) const { return h && c ? ConstImageView(row_start(0, 0), w, h, c, stride, plane) : ConstImageView(); }
+
+      // copies im, of the same size, into the interior and fills the halo
+      void assign(ConstImageView im, BorderMode mode=BorderMode::Replicate);
+
+      // refills the halo from the interior pixels
+      void fill_border(BorderMode mode=BorderMode::Replicate);
+
+      // copy of the interior
+      Image to_image(void) const;
+
+  private:
+      int left=0;          // floats before x=0 in every row, keeps x=0 aligned
+      size_t plane=0;      // floats per channel
+
+      const float* row_start(int row, int channel) const
+        {
+        assert(row >= -border && row < h + border && channel >= 0 && channel < c);
+        return data.data() + channel * plane + static_cast<size_t>(row + border) * stride + left;
+        }
+      float* row_start(int row, int channel) { return const_cast<float*>(std::as_const(*this).row_start(row, channel)); }
+  };
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <functional>
+
+// Tile scheduler shared by the filters. The work is split into rectangular
+// tiles of the output image, run on a library-wide thread pool (the Eigen
+// ThreadPool vendored in include/Eigen). Each output pixel is computed by the
+// same code whatever the tiling, so the results do not depend on the number
+// of threads. Tiles read their halo directly from the (read-only) input image.
+
+// default tile: 256 x 64 float pixels, 64 KB of output, fits in L2 with its input
+constexpr int TILE_W = 256;
+constexpr int TILE_H = 64;
+
+struct Tile
+  {
+  int x0, y0;   // first column and row
+  int x1, y1;   // one past the last column and row
+  };
+
+// Number of threads used by the filters: 0 for one per core (the default),
+// 1 to run everything on the calling thread. Must not be called while a
+// parallel function is running.
+void set_num_threads(int n);
+int get_num_threads(void);
+
+// Runs fn on every tile of a w x h image, in parallel
+void parallel_for_tiles(int w, int h, const std::function<void(const Tile&)>& fn, int tile_w=TILE_W, int tile_h=TILE_H);
+
+// Runs fn(begin, end) on ranges of at least grain items covering [0, n), in parallel
+void parallel_for(int n, const std::function<void(int, int)>& fn, int grain=1);
@@ -0,0 +1,27 @@
+#pragma once
+
+// Runtime selection of the x86 vector extensions used by the SIMD kernels.
+// The kernels are compiled with per-function target attributes, so the
+// library itself does not require any -m flag and runs on any x86-64 CPU.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SRIMG_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+enum class SimdLevel { Scalar = 0, AVX2 = 1, AVX512 = 2 };
+
+// best level supported by the CPU, capped by set_simd_level()
+SimdLevel simd_level(void);
+
+// caps the level used by the kernels (e.g. to compare them against the scalar
+// path). Safe to call while kernels run, which pick up the new level on their
+// next call.
+void set_simd_level(SimdLevel level);
+
+// Conversion between n interleaved 8-bit pixels of c channels and c planar
+// float rows, used by image loading and saving: to float as v/255, to 8 bits
+// as (unsigned char) roundf(255*v). The vector kernels handle c from 1 to 4
+// and give the same bytes and floats as the scalar loops.
+void deinterleave_u8_to_float(const unsigned char* src, int n, int c, float* const* dst);
+void interleave_float_to_u8(const float* const* src, int n, int c, unsigned char* dst);
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+
+#include "image.h"
+#include "edge_map.h"
+
+// 64-bit hash of the size and pixels of an image
+uint64_t image_hash(ConstImageView im);
+
+// Key of a stage result: the key of its input (image_hash(), or the key of
+// the stage it is computed from), the name of the stage and its parameters.
+// Chained keys make every result content-addressed by the original pixels.
+uint64_t stage_key(uint64_t input, std::string_view stage, std::initializer_list<double> params = {});
+
+// Bytes a cached value is accounted for
+inline size_t cached_bytes(const Image& im) { return im.data.size() * sizeof(float); }
+inline size_t cached_bytes(const SectorImage& im) { return im.data.size(); }
+inline size_t cached_bytes(const EdgeMap& edges) { return edges.data.size() * sizeof(uint64_t); }
+inline size_t cached_bytes(const MagnitudeHistogram& hist) { return hist.counts.size() * sizeof(uint64_t); }
+template<typename A, typename B>
+size_t cached_bytes(const std::pair<A,B>& p) { return cached_bytes(p.first) + cached_bytes(p.second); }
+
+struct StageCacheStats
+  {
+  uint64_t hits = 0;        // lookups served from the cache
+  uint64_t misses = 0;      // lookups that had to compute
+  uint64_t evictions = 0;   // values dropped to stay within max_bytes
+  size_t entries = 0;       // values currently cached
+  size_t bytes = 0;         // bytes currently cached
+  };
+
+// In-process memo of decoded images and stage results, evicting the least
+// recently used values beyond max_bytes. Values are shared and immutable: an
+// evicted value stays valid for as long as a caller holds it. A value larger
+// than max_bytes is returned without being cached. Thread-safe; two threads
+// missing the same key both compute it.
+class StageCache
+  {
+  public:
+      static constexpr size_t DEFAULT_MAX_BYTES = size_t(512) << 20;
+
+      explicit StageCache(size_t max_bytes=DEFAULT_MAX_BYTES) : max_bytes(max_bytes) {}
+      StageCache(const StageCache&) = delete;
+      StageCache& operator=(const StageCache&) = delete;
+
+      // The value of key, computed by compute() (returning a T) on a miss
+      template<typename T, typename Compute>
+      std::shared_ptr<const T> get(uint64_t key, Compute&& compute)
+        {
+        key = stage_key(key, typeid(T).name());
+        if (std::shared_ptr<const void> value = find(key)) return std::static_pointer_cast<const T>(value);
+        std::shared_ptr<const T> value = std::make_shared<const T>(compute());
+        insert(key, value, cached_bytes(*value));
+        return value;
+        }
+
+      // load_image() of a file, keyed by its path, size and modification time,
+      // which is also the key for the stages computed from it. Throws as
+      // load_image() if the file cannot be read.
+      std::shared_ptr<const Image> load_image(const std::string& filename);
+      std::shared_ptr<const Image> load_image_gray(const std::string& filename);
+      static uint64_t file_key(const std::string& filename);
+
+      StageCacheStats stats(void) const;
+      void clear(void);
+
+  private:
+      struct Entry
+        {
+        uint64_t key;
+        std::shared_ptr<const void> value;
+        size_t bytes;
+        };
+
+      mutable std::mutex mutex;
+      size_t max_bytes;
+      size_t bytes = 0;
+      uint64_t hits = 0;
+      uint64_t misses = 0;
+      uint64_t evictions = 0;
+      std::list<Entry> lru;     // most recently used first
+      std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+
+      std::shared_ptr<const void> find(uint64_t key);
+      void insert(uint64_t key, std::shared_ptr<const void> value, size_t size);
+  };
+
+// Canny edge detection through the cache, stage by stage as canny() (smooth,
+// compute_gradient, non_maximum_suppression, double_thresholding,
+// edge_tracking) with each result memoized under the key of its input and
+// the parameters it depends on: changing only the thresholds reruns only
+// double_thresholding and edge_tracking. The image must have one channel;
+// the file is loaded with load_image_gray().
+std::shared_ptr<const Image> canny_cached(StageCache& cache, ConstImageView im, const CannyParams& params=CannyParams());
+std::shared_ptr<const Image> canny_cached(StageCache& cache, const std::string& filename, const CannyParams& params=CannyParams());
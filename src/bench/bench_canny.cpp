@@ -0,0 +1,318 @@
+// Stage-level benchmark of the Canny pipeline and of the main filters.
+//
+// bench_canny [--sizes 256,512,...] [--reps N] [--warmup N] [--threads N]
+//             [--slow-max SIZE] [--only name,name] [--json FILE]
+//
+// Each stage runs on synthetic square images of every size, warm-up runs
+// first, then the median, 95th percentile and minimum of the timed runs are
+// reported. The slow reference filters (dense 2D convolution, Eigen
+// convolution, bilateral filter) only run up to --slow-max. arith_separate
+// and arith_fused compare element-wise arithmetic with intermediate images
+// and as a single expression (image_expr.h). The access_*
+// stages measure the cost per pixel read of the accessors of Image: the
+// out-of-line pixel_address() of the shared library, operator(), at() with
+// UncheckedAccess and RowPtr(). deinterleave_u8 and interleave_u8 are the
+// pixel conversions of image loading and saving (RGB, u8 <-> float), the
+// _scalar variants the same without the vector kernels. encode_png_rgb and
+// encode_png_edges_gray1 measure the PNG encoder in memory. hysteresis_float
+// and hysteresis_bits run double thresholding and edge tracking on float
+// images and on bit-packed EdgeMaps (edge_map.h); hysteresis_list tracks the
+// bits straight into an EdgeList, edge_list_dense_scan builds the same list
+// by scanning the dense result instead. With --json the
+// results are also written as JSON ("-" for stdout, the table then going to
+// stderr), to track regressions.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "image.h"
+#include "image_t.h"
+#include "edge_map.h"
+#include "parallel.h"
+#include "simd.h"
+
+using namespace std;
+
+struct Options
+  {
+  vector<int> sizes = {256, 512, 1024, 2048, 4096, 8192};
+  int reps = 5;
+  int warmup = 1;
+  int threads = 0;
+  int slow_max = 512;
+  vector<string> only;
+  string json;
+  };
+
+struct Result
+  {
+  string stage;
+  int size;
+  int reps;
+  double median_ms, p95_ms, min_ms;
+  };
+
+static vector<string> split(const string& s)
+{
+    vector<string> out;
+    stringstream ss(s);
+    for (string item; getline(ss, item, ',');) if (!item.empty()) out.push_back(item);
+    return out;
+}
+
+static Options parse_options(int argc, char** argv)
+{
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        auto value = [&]() -> string {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Missing value for %s\n", arg.c_str());
+                exit(1);
+            }
+            return argv[++i];
+        };
+        if (arg == "--sizes") {
+            opt.sizes.clear();
+            for (const string& s : split(value())) opt.sizes.push_back(stoi(s));
+        }
+        else if (arg == "--reps") opt.reps = max(1, stoi(value()));
+        else if (arg == "--warmup") opt.warmup = max(0, stoi(value()));
+        else if (arg == "--threads") opt.threads = stoi(value());
+        else if (arg == "--slow-max") opt.slow_max = stoi(value());
+        else if (arg == "--only") opt.only = split(value());
+        else if (arg == "--json") opt.json = value();
+        else {
+            fprintf(stderr, "Unknown option %s\n"
+                            "usage: bench_canny [--sizes 256,512,...] [--reps N] [--warmup N] [--threads N]\n"
+                            "                   [--slow-max SIZE] [--only name,name] [--json FILE]\n", arg.c_str());
+            exit(1);
+        }
+    }
+    return opt;
+}
+
+// Grayscale test image with edges at every scale: a smooth background,
+// random discs and rectangles, and a little noise (fixed seed)
+static Image synthetic_image(int size)
+{
+    Image im(size, size, 1);
+    unsigned int seed = 12345;
+    auto rnd = [&]() { seed = seed * 1664525u + 1013904223u; return (seed >> 8) / float(1 << 24); };
+
+    for (int y = 0; y < size; y++)
+        for (int x = 0; x < size; x++)
+            im(x, y) = 0.3f + 0.2f * float(x + y) / (2 * size);
+
+    int shapes = 16 + size / 32;
+    for (int s = 0; s < shapes; s++) {
+        int cx = rnd() * size, cy = rnd() * size;
+        int r = 2 + rnd() * size / 16;
+        float v = rnd();
+        bool disc = rnd() < 0.5f;
+        for (int y = max(0, cy - r); y < min(size, cy + r); y++)
+            for (int x = max(0, cx - r); x < min(size, cx + r); x++)
+                if (!disc || (x - cx) * (x - cx) + (y - cy) * (y - cy) < r * r) im(x, y) = v;
+    }
+
+    for (float& v : im.data) v = std::clamp(v + 0.02f * (rnd() - 0.5f), 0.0f, 1.0f);
+    return im;
+}
+
+// Reads every pixel of im through read(x, y)
+static volatile float pixel_sink;
+
+template<typename Read>
+static void sum_pixels(const Image& im, Read read)
+{
+    float sum = 0;
+    for (int y = 0; y < im.h; y++)
+        for (int x = 0; x < im.w; x++) sum += read(x, y);
+    pixel_sink = sum;
+}
+
+static Result measure(const string& stage, int size, const Options& opt, const function<void()>& fn)
+{
+    for (int i = 0; i < opt.warmup; i++) fn();
+
+    vector<double> ms;
+    for (int i = 0; i < opt.reps; i++) {
+        auto start = chrono::steady_clock::now();
+        fn();
+        ms.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+    }
+    sort(ms.begin(), ms.end());
+    size_t n = ms.size();
+    double median = n % 2 ? ms[n / 2] : 0.5 * (ms[n / 2 - 1] + ms[n / 2]);
+    double p95 = ms[min(n - 1, static_cast<size_t>(0.95 * n))];
+    return {stage, size, opt.reps, median, p95, ms[0]};
+}
+
+static const char* simd_name(SimdLevel level)
+{
+    switch (level) {
+        case SimdLevel::AVX512: return "avx512";
+        case SimdLevel::AVX2: return "avx2";
+        default: return "scalar";
+    }
+}
+
+static void write_json(ostream& out, const Options& opt, const vector<Result>& results)
+{
+    out << "{\n";
+    out << "  \"benchmark\": \"bench_canny\",\n";
+    out << "  \"threads\": " << get_num_threads() << ",\n";
+    out << "  \"simd\": \"" << simd_name(simd_level()) << "\",\n";
+    out << "  \"warmup\": " << opt.warmup << ",\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        double mpix = double(r.size) * r.size / 1e6;
+        out << "    {\"stage\": \"" << r.stage << "\", \"width\": " << r.size << ", \"height\": " << r.size
+            << ", \"reps\": " << r.reps << ", \"median_ms\": " << r.median_ms << ", \"p95_ms\": " << r.p95_ms
+            << ", \"min_ms\": " << r.min_ms << ", \"mpix_per_s\": " << mpix / (r.median_ms / 1e3) << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+int main(int argc, char** argv)
+{
+    Options opt = parse_options(argc, argv);
+    set_num_threads(opt.threads);
+
+    // with the JSON on stdout, the table goes to stderr
+    FILE* table = opt.json == "-" ? stderr : stdout;
+    fprintf(table, "bench_canny: %d threads, %s, %d warm-up + %d timed runs\n",
+           get_num_threads(), simd_name(simd_level()), opt.warmup, opt.reps);
+#ifndef __OPTIMIZE__
+    fprintf(table, "warning: built without optimizations, configure with -DCMAKE_BUILD_TYPE=Release\n");
+#endif
+    fprintf(table, "%-28s %6s %12s %12s %12s %10s\n", "stage", "size", "median ms", "p95 ms", "min ms", "Mpix/s");
+
+    vector<Result> results;
+    auto wanted = [&](const string& stage) { return opt.only.empty() || find(opt.only.begin(), opt.only.end(), stage) != opt.only.end(); };
+
+    for (int size : opt.sizes) {
+        Image im = synthetic_image(size);
+        Image rgb = grayscale_to_rgb(im, 1, 1, 1);
+        CannyParams params;
+
+        // inputs of every stage, computed once
+        Image smooth = smooth_image(im, params.sigma);
+        pair<Image,Image> grad = compute_gradient(smooth);
+        Image nms = non_maximum_suppression(grad.first, grad.second);
+        Image dt = double_thresholding(nms, params.low, params.high, params.strong, params.weak);
+        Image gauss = make_gaussian_filter(params.sigma);
+        Image gauss_rgb = grayscale_to_rgb(smooth, 1, 1, 1);
+        ImageU8 im8 = convert_image<uint8_t>(im);
+        ImageU8 smooth8 = smooth_image(im8, params.sigma);
+        vector<unsigned char> rgb8(rgb.size());
+        const float* rgb_planes[3] = {rgb.RowPtr(0, 0).data(), rgb.RowPtr(0, 1).data(), rgb.RowPtr(0, 2).data()};
+        Image rgb_out(size, size, 3);
+        float* out_planes[3] = {rgb_out.RowPtr(0, 0).data(), rgb_out.RowPtr(0, 1).data(), rgb_out.RowPtr(0, 2).data()};
+        auto scalar = [](auto&& fn) { set_simd_level(SimdLevel::Scalar); fn(); set_simd_level(SimdLevel::AVX512); };
+
+        bool slow = size <= opt.slow_max;
+        vector<pair<string, function<void()>>> stages = {
+            {"smooth_image", [&] { smooth_image(im, params.sigma); }},
+            {"smooth_image_recursive", [&] { smooth_image_recursive(im, 4); }},
+            {"compute_gradient", [&] { compute_gradient(smooth); }},
+            {"compute_gradient_sectors", [&] { compute_gradient_sectors(smooth); }},
+            {"non_maximum_suppression", [&] { non_maximum_suppression(grad.first, grad.second); }},
+            {"double_thresholding", [&] { double_thresholding(nms, params.low, params.high, params.strong, params.weak); }},
+            {"edge_tracking", [&] { edge_tracking(dt, params.weak, params.strong); }},
+            {"edge_tracking_connected", [&] { edge_tracking_connected(dt, params.weak, params.strong); }},
+            {"canny_fused", [&] { canny_fused(im, params); }},
+            {"smooth_image_u8", [&] { smooth_image(im8, params.sigma); }},
+            {"sobel_image_s16", [&] { sobel_image_s16(smooth8); }},
+            {"canny_u8", [&] { canny_u8(im8, params); }},
+        };
+        // element-wise arithmetic, as separate passes with intermediate images
+        // and as one fused expression
+        stages.push_back({"arith_separate", [&] {
+            Image t = sub_image(rgb, gauss_rgb);
+            scale_image(t, 0, 0.5f); scale_image(t, 1, 0.5f); scale_image(t, 2, 0.5f);
+            t = add_image(t, rgb);
+            clamp_image(t);
+        }});
+        stages.push_back({"arith_fused", [&] { Image t = clamp((rgb - gauss_rgb) * 0.5f + rgb); }});
+        stages.push_back({"deinterleave_u8", [&] { deinterleave_u8_to_float(rgb8.data(), size * size, 3, out_planes); }});
+        stages.push_back({"deinterleave_u8_scalar", [&] {
+            scalar([&] { deinterleave_u8_to_float(rgb8.data(), size * size, 3, out_planes); });
+        }});
+        stages.push_back({"interleave_u8", [&] { interleave_float_to_u8(rgb_planes, size * size, 3, rgb8.data()); }});
+        stages.push_back({"interleave_u8_scalar", [&] {
+            scalar([&] { interleave_float_to_u8(rgb_planes, size * size, 3, rgb8.data()); });
+        }});
+        Image edges = edge_tracking(dt, params.weak, params.strong);
+        PngOptions gray1;
+        gray1.format = PngFormat::Gray1;
+        EdgeMap strong_bits, weak_bits, edge_bits;
+        stages.push_back({"hysteresis_float", [&] {
+            edge_tracking(double_thresholding(nms, params.low, params.high, params.strong, params.weak), params.weak, params.strong);
+        }});
+        stages.push_back({"hysteresis_bits", [&] {
+            double_thresholding_into(nms, params.low, params.high, strong_bits, weak_bits);
+            edge_tracking_into(strong_bits, weak_bits, edge_bits);
+        }});
+        EdgeList edge_list;
+        stages.push_back({"hysteresis_list", [&] {
+            double_thresholding_into(nms, params.low, params.high, strong_bits, weak_bits);
+            edge_tracking_into(strong_bits, weak_bits, nms, grad.second, edge_list);
+        }});
+        stages.push_back({"edge_list_dense_scan", [&] {
+            edge_list.clear();
+            for (int y = 0; y < size; y++)
+                for (int x = 0; x < size; x++)
+                    if (edges(x, y, 0) != 0) edge_list.push_back(x, y, nms(x, y, 0), 0);
+        }});
+        stages.push_back({"encode_png_rgb", [&] { encode_png(rgb); }});
+        stages.push_back({"encode_png_edges_gray1", [&] { encode_png(edges, gray1); }});
+        stages.push_back({"access_pixel_address", [&] {
+            sum_pixels(im, [&](int x, int y) { return im.data[pixel_address(im, x, y, 0)]; });
+        }});
+        stages.push_back({"access_operator", [&] { sum_pixels(im, [&](int x, int y) { return im(x, y); }); }});
+        stages.push_back({"access_unchecked", [&] {
+            sum_pixels(im, [&](int x, int y) { return im.at<UncheckedAccess>(x, y, 0); });
+        }});
+        stages.push_back({"access_row_ptr", [&] {
+            sum_pixels(im, [&](int x, int y) { return im.RowPtr(y, 0)[x]; });
+        }});
+        if (slow) {
+            stages.push_back({"convolve_image", [&] { convolve_image(rgb, gauss, true); }});
+            stages.push_back({"convolve_image_fast", [&] { convolve_image_fast(rgb, gauss, true); }});
+            stages.push_back({"bilateral_filter", [&] { bilateral_filter(im, params.sigma, 0.1); }});
+        }
+
+        for (auto& [name, fn] : stages) {
+            if (!wanted(name)) continue;
+            Result r = measure(name, size, opt, fn);
+            fprintf(table, "%-28s %6d %12.3f %12.3f %12.3f %10.1f\n", r.stage.c_str(), r.size, r.median_ms, r.p95_ms, r.min_ms,
+                   double(size) * size / 1e6 / (r.median_ms / 1e3));
+            fflush(table);
+            results.push_back(r);
+        }
+    }
+
+    if (opt.json == "-") {
+        ostringstream out;
+        write_json(out, opt, results);
+        fputs(out.str().c_str(), stdout);
+    } else if (!opt.json.empty()) {
+        ofstream out(opt.json);
+        write_json(out, opt, results);
+        if (!out) {
+            fprintf(stderr, "Cannot write %s\n", opt.json.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
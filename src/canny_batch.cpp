@@ -0,0 +1,172 @@
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include "../include/image.h"
+
+
+// Blocking FIFO of bounded capacity: push() waits while the queue is full,
+// pop() waits while it is empty and returns nothing once it is closed and drained
+template<typename T>
+class BoundedQueue
+  {
+  std::mutex mutex;
+  std::condition_variable not_full, not_empty;
+  std::deque<T> items;
+  size_t capacity;
+  bool closed = false;
+
+public:
+  explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+  void push(T item)
+    {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_full.wait(lock, [&] { return items.size() < capacity; });
+    items.push_back(std::move(item));
+    not_empty.notify_one();
+    }
+
+  std::optional<T> pop(void)
+    {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait(lock, [&] { return !items.empty() || closed; });
+    if (items.empty()) return std::nullopt;
+    T item = std::move(items.front());
+    items.pop_front();
+    not_full.notify_one();
+    return item;
+    }
+
+  void close(void)
+    {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    not_empty.notify_all();
+    }
+  };
+
+struct BatchItem
+  {
+  size_t index;
+  Image im;
+  };
+
+
+// Output names (without extension) of the inputs: their stem, made unique
+// with the index of the input when several inputs share it
+static std::vector<std::string> output_names(const std::vector<std::string>& paths)
+{
+    std::vector<std::string> names(paths.size());
+    std::map<std::string, int> uses;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        names[i] = std::filesystem::path(paths[i]).stem().string();
+        uses[names[i]]++;
+    }
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (uses[names[i]] == 1) continue;
+        std::string name = names[i] + "_" + std::to_string(i);
+        while (uses.count(name)) name += "_" + std::to_string(i);
+        uses[name] = 1;
+        names[i] = name;
+    }
+    return names;
+}
+
+/*
+    Runs the Canny edge detector on a list of images, overlapping decoding,
+    processing and encoding: each step has its own threads, connected by
+    bounded queues so that at most a few decoded images are in memory.
+    The edge maps are saved as out_dir/<input name>.png; inputs sharing a
+    name (a.png and a.jpg, or the same name in two directories) are saved as
+    out_dir/<input name>_<index in paths>.png instead of overwriting each
+    other.
+    Input:
+        vector<string> paths: the input images
+        CannyParams params: parameters of canny_fused()
+        string out_dir: output directory, created if missing
+        int workers: threads per step, 0 for one per core
+    Output:
+        BatchStats: number of images processed and failed, time and throughput
+*/
+BatchStats canny_batch(const vector<string>& paths, const CannyParams& params, const string& out_dir, int workers)
+{
+    namespace fs = std::filesystem;
+    fs::create_directories(out_dir);
+    if (workers <= 0) workers = std::max(1u, std::thread::hardware_concurrency());
+
+    BatchStats stats;
+    std::mutex stats_mutex;
+    auto fail = [&](size_t index) {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        stats.failed_paths.push_back(paths[index]);
+    };
+
+    const std::vector<std::string> outputs = output_names(paths);
+
+    const size_t capacity = 2 * static_cast<size_t>(workers);
+    BoundedQueue<size_t> todo(paths.size() + 1);
+    BoundedQueue<BatchItem> decoded(capacity), processed(capacity);
+    for (size_t i = 0; i < paths.size(); ++i) todo.push(i);
+    todo.close();
+
+    // edge maps hold 0 and params.strong: one bit per pixel when that is 1
+    PngOptions png;
+    png.format = params.strong == 1.0f ? PngFormat::Gray1 : PngFormat::Gray8;
+
+    auto start = std::chrono::steady_clock::now();
+
+    auto decode = [&] {
+        while (auto index = todo.pop()) {
+            try {
+                decoded.push({*index, load_image_gray(paths[*index])});
+            } catch (const std::exception&) {
+                fail(*index);
+            }
+        }
+    };
+    auto process = [&] {
+        while (auto item = decoded.pop()) {
+            try {
+                processed.push({item->index, canny_fused(item->im, params)});
+            } catch (const std::exception&) {
+                fail(item->index);
+            }
+        }
+    };
+    auto encode = [&] {
+        while (auto item = processed.pop()) {
+            try {
+                save_png(item->im, fs::path(out_dir) / outputs[item->index], png);
+                std::lock_guard<std::mutex> lock(stats_mutex);
+                stats.images++;
+            } catch (const std::exception&) {
+                fail(item->index);
+            }
+        }
+    };
+
+    std::vector<std::thread> decoders, processors, encoders;
+    for (int i = 0; i < workers; ++i) {
+        decoders.emplace_back(decode);
+        processors.emplace_back(process);
+        encoders.emplace_back(encode);
+    }
+
+    // close each queue once all of its producers are done
+    for (auto& t : decoders) t.join();
+    decoded.close();
+    for (auto& t : processors) t.join();
+    processed.close();
+    for (auto& t : encoders) t.join();
+
+    stats.failed = stats.failed_paths.size();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stats.images_per_second = stats.seconds > 0 ? stats.images / stats.seconds : 0;
+    return stats;
+}
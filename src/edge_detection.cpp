@@ -4,23 +4,386 @@
 #include <math.h>
 #include <assert.h>
 #include "../include/image.h"
+#include "../include/simd.h"
+#include "../include/parallel.h"
+#include "../include/image_pool.h"
+#include "../include/image_t.h"
+#include "../include/edge_map.h"
+
+#include <bit>
+#include <mutex>
+#include <type_traits>
 
 #define M_PI 3.14159265358979323846
 
 
+// Neighbour offsets along the gradient direction, indexed by the direction
+// rounded to the nearest multiple of PI/4 (modulo PI, since the two
+// neighbours are symmetric): 0 = horizontal, 1 = diagonal, 2 = vertical, 3 = anti-diagonal
+static const int NMS_DX[4] = {1, 1, 0, -1};
+static const int NMS_DY[4] = {0, 1, 1, 1};
+
+// Rounds a direction in [-pi,pi] to the nearest multiple of PI/4 and folds it in [0,3]
+static inline int direction_sector(float angle)
+{
+    int k = (int) roundf(angle / (M_PI / 4));
+    return (k + 8) % 4;
+}
+
+// Sector of the gradient (gx,gy) without computing its angle: the direction is
+// horizontal within PI/8 of the x axis, vertical within PI/8 of the y axis,
+// and otherwise diagonal when gx and gy have the same sign
+static const float TAN_PI_8 = 0.414213562f;
+
+static inline int gradient_sector(float gx, float gy)
+{
+    float ax = fabsf(gx), ay = fabsf(gy);
+    if (ay <= TAN_PI_8 * ax) return 0;
+    if (ax <= TAN_PI_8 * ay) return 2;
+    return (gx > 0) == (gy > 0) ? 1 : 3;
+}
+
+// Gradient magnitude and direction, computed exactly as sobel_image() does
+static inline float gradient_magnitude(double gx, double gy) { return sqrtf(pow(gx, 2) + pow(gy, 2)); }
+static inline float gradient_direction(double gx, double gy) { return atan2f(gy, gx); }
+
+static inline float threshold_value(float v, float lowThreshold, float highThreshold, float strongVal, float weakVal)
+{
+    if (v >= highThreshold) return strongVal;
+    if (v >= lowThreshold) return weakVal;
+    return 0;
+}
+
+
+static inline int clamp_index(int i, int n) { return i < 0 ? 0 : (i >= n ? n - 1 : i); }
+
+// Non-maximum suppression of pixels [x0,x1) of a row, given the rows above
+// and below it (the row itself at the top and bottom borders, as with clamping)
+// and the direction sectors of the row. Without Clamp the rows must have a
+// readable halo of one pixel on both sides.
+template<bool Clamp=true>
+static void suppress_row_scalar(const float* up, const float* mid, const float* down, const uint8_t* sector,
+                                int x0, int x1, int w, float* out)
+{
+    const float* rows[3] = {up, mid, down};
+    for (int x = x0; x < x1; ++x) {
+        int dx = NMS_DX[sector[x]];
+        int dy = NMS_DY[sector[x]];
+        float m = mid[x];
+        float neighbor1 = rows[1 + dy][Clamp ? clamp_index(x + dx, w) : x + dx];
+        float neighbor2 = rows[1 - dy][Clamp ? clamp_index(x - dx, w) : x - dx];
+        out[x] = (m >= neighbor1 && m >= neighbor2) ? m : 0;
+    }
+}
+
+#ifdef SRIMG_X86_SIMD
+// Vector versions of suppress_row_scalar() for the columns 1..w-2, where
+// the neighbours never need clamping: the candidate neighbours of the four
+// sectors are loaded for all lanes and blended by sector. They return the
+// first column left for the scalar tail.
+
+__attribute__((target("avx2")))
+static int suppress_row_avx2(const float* up, const float* mid, const float* down, const uint8_t* sector,
+                             int x0, int x1, float* out)
+{
+    const __m256i one = _mm256_set1_epi32(1), two = _mm256_set1_epi32(2), three = _mm256_set1_epi32(3);
+    int x = x0;
+    for (; x + 8 <= x1; x += 8) {
+        __m256i s = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(sector + x)));
+        __m256 s1 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(s, one));
+        __m256 s2 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(s, two));
+        __m256 s3 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(s, three));
+
+        __m256 m = _mm256_loadu_ps(mid + x);
+        __m256 n1 = _mm256_loadu_ps(mid + x + 1);
+        __m256 n2 = _mm256_loadu_ps(mid + x - 1);
+        n1 = _mm256_blendv_ps(n1, _mm256_loadu_ps(down + x + 1), s1);
+        n2 = _mm256_blendv_ps(n2, _mm256_loadu_ps(up + x - 1), s1);
+        n1 = _mm256_blendv_ps(n1, _mm256_loadu_ps(down + x), s2);
+        n2 = _mm256_blendv_ps(n2, _mm256_loadu_ps(up + x), s2);
+        n1 = _mm256_blendv_ps(n1, _mm256_loadu_ps(down + x - 1), s3);
+        n2 = _mm256_blendv_ps(n2, _mm256_loadu_ps(up + x + 1), s3);
+
+        __m256 keep = _mm256_and_ps(_mm256_cmp_ps(m, n1, _CMP_GE_OQ), _mm256_cmp_ps(m, n2, _CMP_GE_OQ));
+        _mm256_storeu_ps(out + x, _mm256_and_ps(keep, m));
+    }
+    return x;
+}
+
+__attribute__((target("avx512f")))
+static int suppress_row_avx512(const float* up, const float* mid, const float* down, const uint8_t* sector,
+                               int x0, int x1, float* out)
+{
+    const __m512i one = _mm512_set1_epi32(1), two = _mm512_set1_epi32(2), three = _mm512_set1_epi32(3);
+    int x = x0;
+    for (; x + 16 <= x1; x += 16) {
+        __m512i s = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(sector + x)));
+        __mmask16 s1 = _mm512_cmpeq_epi32_mask(s, one);
+        __mmask16 s2 = _mm512_cmpeq_epi32_mask(s, two);
+        __mmask16 s3 = _mm512_cmpeq_epi32_mask(s, three);
+
+        __m512 m = _mm512_loadu_ps(mid + x);
+        __m512 n1 = _mm512_loadu_ps(mid + x + 1);
+        __m512 n2 = _mm512_loadu_ps(mid + x - 1);
+        n1 = _mm512_mask_blend_ps(s1, n1, _mm512_loadu_ps(down + x + 1));
+        n2 = _mm512_mask_blend_ps(s1, n2, _mm512_loadu_ps(up + x - 1));
+        n1 = _mm512_mask_blend_ps(s2, n1, _mm512_loadu_ps(down + x));
+        n2 = _mm512_mask_blend_ps(s2, n2, _mm512_loadu_ps(up + x));
+        n1 = _mm512_mask_blend_ps(s3, n1, _mm512_loadu_ps(down + x - 1));
+        n2 = _mm512_mask_blend_ps(s3, n2, _mm512_loadu_ps(up + x + 1));
+
+        __mmask16 keep = _mm512_cmp_ps_mask(m, n1, _CMP_GE_OQ) & _mm512_cmp_ps_mask(m, n2, _CMP_GE_OQ);
+        _mm512_storeu_ps(out + x, _mm512_maskz_mov_ps(keep, m));
+    }
+    return x;
+}
+#endif
+
+// Non-maximum suppression of a whole row: vector kernels inside, scalar
+// code for the first and last column and for the tail
+static void suppress_row(const float* up, const float* mid, const float* down, const uint8_t* sector, int w, float* out)
+{
+    if (w < 3) {
+        suppress_row_scalar(up, mid, down, sector, 0, w, w, out);
+        return;
+    }
+    suppress_row_scalar(up, mid, down, sector, 0, 1, w, out);
+    int x = 1;
+#ifdef SRIMG_X86_SIMD
+    SimdLevel level = simd_level();
+    if (level >= SimdLevel::AVX512) x = suppress_row_avx512(up, mid, down, sector, x, w - 1, out);
+    if (level >= SimdLevel::AVX2) x = suppress_row_avx2(up, mid, down, sector, x, w - 1, out);
+#endif
+    suppress_row_scalar(up, mid, down, sector, x, w, w, out);
+}
+
+// Same as suppress_row(), for rows with a replicated halo of one pixel:
+// every column goes through the vector kernels
+static void suppress_row_padded(const float* up, const float* mid, const float* down, const uint8_t* sector, int w, float* out)
+{
+    int x = 0;
+#ifdef SRIMG_X86_SIMD
+    SimdLevel level = simd_level();
+    if (level >= SimdLevel::AVX512) x = suppress_row_avx512(up, mid, down, sector, x, w, out);
+    if (level >= SimdLevel::AVX2) x = suppress_row_avx2(up, mid, down, sector, x, w, out);
+#endif
+    suppress_row_scalar<false>(up, mid, down, sector, x, w, w, out);
+}
+
+// One row of the separable Gaussian: vertical pass over the (clamped) input
+// rows into tmp, then horizontal pass from tmp into out. Sums are kept in
+// double, so that the result stays as close to the 2D filter as the rounding
+// of the latter allows (non-maximum suppression is sensitive to near ties).
+static void smooth_row_separable(ConstImageView im, int ch, const Image& kernel, int y, double* tmp, float* out)
+{
+    const int w = im.w;
+    const int r = kernel.w / 2;
+    const float* k = kernel.data.data() + r;
+
+    std::fill(tmp, tmp + w, 0.0);
+    for (int m = -r; m <= r; ++m) {
+        const float* src = im.RowPtr(clamp_index(y + m, im.h), ch).data();
+        const double km = k[m];
+        for (int x = 0; x < w; ++x) tmp[x] += src[x] * km;
+    }
+
+    for (int x = 0; x < w; ++x) {
+        double sum = 0;
+        if (x >= r && x < w - r) {
+            for (int l = -r; l <= r; ++l) sum += tmp[x + l] * k[l];
+        } else {
+            for (int l = -r; l <= r; ++l) sum += tmp[clamp_index(x + l, w)] * k[l];
+        }
+        out[x] = sum;
+    }
+}
+
+
 /*
 Smooths a grayscale image by convolving it with a Gaussian kernel of standard deviation sigma.
+The filter is applied as two 1D passes for small sigma and as a recursive
+(IIR) filter, whose cost does not depend on sigma, from SMOOTH_RECURSIVE_SIGMA on.
 Input:
     Image im: the input image
     float sigma: the standard deviation of the Gaussian kernel
 Output:
     Image: the smoothed image (im.w, im.h, 1)
 */
-Image smooth_image(const Image& im, float sigma)
+Image smooth_image(ConstImageView im, float sigma)
+{
+    Image res = acquire_image(im.w, im.h, im.c);
+    smooth_image_into(im, sigma, res);
+    return res;
+}
+
+void smooth_image_into(ConstImageView im, float sigma, Image& out)
+{
+    if (sigma >= SMOOTH_RECURSIVE_SIGMA) smooth_image_recursive_into(im, sigma, out);
+    else smooth_image_separable_into(im, sigma, out);
+}
+
+
+/*
+Smooths an image with the separable form of make_gaussian_filter(sigma):
+a vertical and an horizontal 1D convolution, 2*(6*sigma+1) taps per pixel
+instead of (6*sigma+1)^2. Borders are clamped as in convolve_image().
+Input:
+    Image im: the input image
+    float sigma: the standard deviation of the Gaussian kernel
+Output:
+    Image: the smoothed image (im.w, im.h, im.c)
+*/
+Image smooth_image_separable(ConstImageView im, float sigma)
+{
+    Image res = acquire_image(im.w, im.h, im.c);
+    smooth_image_separable_into(im, sigma, res);
+    return res;
+}
+
+void smooth_image_separable_into(ConstImageView im, float sigma, Image& res)
+{
+    Image kernel = make_gaussian_filter_1d(sigma);
+    res.reshape(im.w, im.h, im.c);
+
+    for (int k = 0; k < im.c; ++k) {
+        parallel_for(im.h, [&](int y0, int y1) {
+            std::vector<double> tmp(im.w);
+            for (int y = y0; y < y1; ++y)
+                smooth_row_separable(im, k, kernel, y, tmp.data(), res.RowPtr(y, k).data());
+        }, TILE_H);
+    }
+}
+
+
+// Coefficients of the Young - van Vliet recursive Gaussian filter:
+// v[n] = B u[n] + a1 v[n-1] + a2 v[n-2] + a3 v[n-3], run forward and then backward
+struct RecursiveGaussian
+{
+    float B, a1, a2, a3;
+
+    explicit RecursiveGaussian(float sigma)
+    {
+        double q = sigma >= 2.5 ? 0.98711 * sigma - 0.96330
+                                : 3.97156 - 4.14554 * sqrt(1 - 0.26891 * sigma);
+        double q2 = q * q, q3 = q2 * q;
+        double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+        double b1 = 2.44413 * q + 2.85619 * q2 + 1.26661 * q3;
+        double b2 = -(1.4281 * q2 + 1.26661 * q3);
+        double b3 = 0.422205 * q3;
+        a1 = b1 / b0;
+        a2 = b2 / b0;
+        a3 = b3 / b0;
+        B = 1 - (b1 + b2 + b3) / b0;
+    }
+};
+
+// Filters one line of n samples in place. The line is extended by pad
+// replicated samples on the right (on the left the steady state of the
+// replicated border is exact), tmp must hold n+pad samples.
+static void recursive_gaussian_line(float* line, int n, int pad, const RecursiveGaussian& g, float* tmp)
 {
-    // TODO: Your code here
-    NOT_IMPLEMENTED();
-    return im;
+    float p1 = line[0], p2 = line[0], p3 = line[0];
+    for (int i = 0; i < n + pad; ++i) {
+        float v = g.B * line[std::min(i, n - 1)] + g.a1 * p1 + g.a2 * p2 + g.a3 * p3;
+        tmp[i] = v;
+        p3 = p2; p2 = p1; p1 = v;
+    }
+    p1 = p2 = p3 = tmp[n + pad - 1];
+    for (int i = n + pad - 1; i >= 0; --i) {
+        float v = g.B * tmp[i] + g.a1 * p1 + g.a2 * p2 + g.a3 * p3;
+        if (i < n) line[i] = v;
+        p3 = p2; p2 = p1; p1 = v;
+    }
+}
+
+// Same as recursive_gaussian_line() along the w columns of a plane whose rows
+// are stride floats apart, processing whole rows at a time so that the inner
+// loops are contiguous
+static void recursive_gaussian_columns(float* plane, int stride, int w, int h, int pad, const RecursiveGaussian& g, std::vector<float>& tmp)
+{
+    tmp.resize(static_cast<size_t>(w) * (h + pad + 3));
+    auto row = [&](int y) { return plane + static_cast<size_t>(y) * stride; };
+    auto trow = [&](int y) { return tmp.data() + static_cast<size_t>(y) * w; };
+
+    // forward pass into tmp, the rows before the first one being equal to it
+    const float* p[3] = {row(0), row(0), row(0)};
+    for (int y = 0; y < h + pad; ++y) {
+        const float* u = row(std::min(y, h - 1));
+        float* v = trow(y);
+        for (int x = 0; x < w; ++x) v[x] = g.B * u[x] + g.a1 * p[0][x] + g.a2 * p[1][x] + g.a3 * p[2][x];
+        p[2] = p[1]; p[1] = p[0]; p[0] = v;
+    }
+
+    // backward pass into the plane, the padding rows go in the last three rows of tmp
+    p[0] = p[1] = p[2] = trow(h + pad - 1);
+    for (int y = h + pad - 1; y >= 0; --y) {
+        const float* u = trow(y);
+        float* v = y < h ? row(y) : trow(h + pad + y % 3);
+        for (int x = 0; x < w; ++x) v[x] = g.B * u[x] + g.a1 * p[0][x] + g.a2 * p[1][x] + g.a3 * p[2][x];
+        p[2] = p[1]; p[1] = p[0]; p[0] = v;
+    }
+}
+
+
+/*
+Smooths an image with the recursive Gaussian of Young and van Vliet
+(third order, forward and backward pass along each axis). The cost per pixel
+does not depend on sigma, so this is the method of choice for large sigma,
+while for small sigma the approximation of the Gaussian is coarser.
+Input:
+    Image im: the input image
+    float sigma: the standard deviation of the Gaussian (>= 0.5)
+Output:
+    Image: the smoothed image (im.w, im.h, im.c)
+*/
+Image smooth_image_recursive(ConstImageView im, float sigma)
+{
+    Image res = acquire_image(im.w, im.h, im.c);
+    smooth_image_recursive_into(im, sigma, res);
+    return res;
+}
+
+// The filter runs in place: the buffer of an rvalue input is reused
+Image smooth_image_recursive(Image&& im, float sigma)
+{
+    smooth_image_recursive_into(im, sigma, im);
+    return std::move(im);
+}
+
+void smooth_image_recursive_into(ConstImageView im, float sigma, Image& res)
+{
+    assert(sigma >= 0.5f);
+    // in place when res is the input image, the filter runs on res anyway
+    bool in_place = res.data.data() == im.ptr;
+    assert(!in_place || (im.is_contiguous() && res.w == im.w && res.h == im.h && res.c == im.c));
+    res.reshape(im.w, im.h, im.c);
+    if (im.w == 0 || im.h == 0) return;
+    for (int k = 0; k < im.c && !in_place; ++k)
+        for (int y = 0; y < im.h; ++y) {
+            std::span<const float> src = im.RowPtr(y, k);
+            std::copy(src.begin(), src.end(), res.RowPtr(y, k).begin());
+        }
+
+    RecursiveGaussian g(sigma);
+    int pad = (int) ceilf(4 * sigma);
+
+    for (int k = 0; k < im.c; ++k) {
+        // rows in parallel, then strips of columns in parallel
+        parallel_for(im.h, [&](int y0, int y1) {
+            std::vector<float> tmp(im.w + pad);
+            for (int y = y0; y < y1; ++y)
+                recursive_gaussian_line(res.RowPtr(y, k).data(), im.w, pad, g, tmp.data());
+        }, TILE_H);
+
+        int strips = (im.w + TILE_W - 1) / TILE_W;
+        parallel_for(strips, [&](int s0, int s1) {
+            std::vector<float> rows;
+            for (int s = s0; s < s1; ++s) {
+                int x0 = s * TILE_W, x1 = std::min(im.w, x0 + TILE_W);
+                recursive_gaussian_columns(res.RowPtr(0, k).data() + x0, im.w, x1 - x0, im.h, pad, g, rows);
+            }
+        });
+    }
 }
 
 
@@ -32,11 +395,78 @@ Output:
     pair<Image,Image>: the magnitude and direction of the gradient of the image
                        with magnitude in [0,1] and direction in [-pi,pi]
 */
-pair<Image,Image> compute_gradient(const Image& im)
+pair<Image,Image> compute_gradient(ConstImageView im)
+{
+    pair<Image,Image> grad = sobel_image(im);
+    feature_normalize(grad.first);
+    return grad;
+}
+
+void compute_gradient_into(ConstImageView im, Image& mag, Image& dir)
+{
+    sobel_image_into(im, mag, dir);
+    feature_normalize(mag);
+}
+
+
+// Non-maximum suppression of the whole image, bands of rows in parallel.
+// row_sectors(y, buffer) returns the direction sectors of row y, possibly
+// computing them in buffer. If hist is given, the non-zero output values are
+// added to it while each row is still in cache. mag is an Image or a
+// PaddedImage with a replicated halo, whose rows need no clamping.
+template<typename Magnitude, typename RowSectors>
+static void suppress_image(const Magnitude& mag, RowSectors row_sectors, MagnitudeHistogram* hist, Image& nms)
+{
+    nms.reshape(mag.w, mag.h, 1);
+    std::mutex hist_mutex;
+
+    parallel_for(mag.h, [&](int y0, int y1) {
+        std::vector<uint8_t> buffer(mag.w);
+        std::vector<uint64_t> counts(hist ? MagnitudeHistogram::BINS : 0);
+        for (int y = y0; y < y1; y++) {
+            float* out = nms.RowPtr(y, 0).data();
+            if constexpr (std::is_same_v<Magnitude, PaddedImage>)
+                suppress_row_padded(mag.RowPtr(y - 1, 0).data(), mag.RowPtr(y, 0).data(),
+                                    mag.RowPtr(y + 1, 0).data(), row_sectors(y, buffer.data()), mag.w, out);
+            else
+                suppress_row(mag.RowPtr(clamp_index(y - 1, mag.h), 0).data(), mag.RowPtr(y, 0).data(),
+                             mag.RowPtr(clamp_index(y + 1, mag.h), 0).data(), row_sectors(y, buffer.data()), mag.w, out);
+            if (hist) {
+                for (int x = 0; x < mag.w; x++)
+                    if (out[x] > 0) counts[MagnitudeHistogram::bin(out[x])]++;
+            }
+        }
+        if (hist) {
+            std::lock_guard<std::mutex> lock(hist_mutex);
+            for (int i = 0; i < MagnitudeHistogram::BINS; i++) {
+                hist->counts[i] += counts[i];
+                hist->total += counts[i];
+            }
+        }
+    }, TILE_H);
+}
+
+template<typename Magnitude, typename RowSectors>
+static Image suppress_image(const Magnitude& mag, RowSectors row_sectors, MagnitudeHistogram* hist)
+{
+    Image nms = acquire_image(mag.w, mag.h, 1);
+    suppress_image(mag, row_sectors, hist, nms);
+    return nms;
+}
+
+// Rounds the directions of a row to the nearest multiple of PI/4
+static auto float_direction_sectors(ConstImageView dir)
+{
+    return [dir](int y, uint8_t* buffer) -> const uint8_t* {
+        std::span<const float> d = dir.RowPtr(y, 0);
+        for (int x = 0; x < dir.w; x++) buffer[x] = direction_sector(d[x]);
+        return buffer;
+    };
+}
+
+static auto quantized_direction_sectors(const SectorImage& dir)
 {
-    // TODO: Your code here
-    NOT_IMPLEMENTED();
-    return{im, im};
+    return [&dir](int y, uint8_t*) -> const uint8_t* { return &dir.data[y * dir.w]; };
 }
 
 
@@ -48,31 +478,143 @@ Input:
 Output:
     Image: the image after non-maximum suppression
 */
-Image non_maximum_suppression(const Image& mag, const Image& dir)
+Image non_maximum_suppression(ConstImageView mag, ConstImageView dir)
 {
-    Image nms(mag.w, mag.h, 1);
-    float neighbor1, neighbor2;
+    // For each pixel, round the direction of the gradient to the nearest multiple of PI/4
+    // and keep the pixel if it is not smaller than both neighbors along that direction
+    return suppress_image(mag, float_direction_sectors(dir), nullptr);
+}
 
-    // Iterate through the image and perform non-maximum suppression
-    for (int y = 0; y < mag.h; y++) {
-        for (int x = 0; x < mag.w; x++) {
-            
-            // TODO: Your code here
-            NOT_IMPLEMENTED();
 
-            // Get the direction of the gradient at the current pixel
+/*
+Performs non-maximum suppression on an image, and accumulates the histogram
+of the resulting magnitudes in the same pass, for auto_thresholds().
+Input:
+    Image mag: the magnitude of the gradient of the image [0,1]
+    Image dir: the direction of the gradient of the image [-pi,pi]
+    MagnitudeHistogram hist: histogram to which the non-zero outputs are added
+Output:
+    Image: the image after non-maximum suppression
+*/
+Image non_maximum_suppression(ConstImageView mag, ConstImageView dir, MagnitudeHistogram& hist)
+{
+    return suppress_image(mag, float_direction_sectors(dir), &hist);
+}
 
-            // Round the direction to the nearest multiple of PI/4
+void non_maximum_suppression_into(ConstImageView mag, ConstImageView dir, Image& out)
+{
+    suppress_image(mag, float_direction_sectors(dir), nullptr, out);
+}
 
-            // Get the magnitude of the gradient of the two neighbors along that direction
-            // (Hint: use clamped_pixel to avoid going out of bounds)            
+void non_maximum_suppression_into(ConstImageView mag, ConstImageView dir, MagnitudeHistogram& hist, Image& out)
+{
+    suppress_image(mag, float_direction_sectors(dir), &hist, out);
+}
+
+
+/*
+Computes the magnitude and the quantized direction of the gradient of an image.
+Same as compute_gradient(), but the direction is given directly as the sector
+used by non_maximum_suppression(), from the signs of gx and gy and a comparison
+with tan(PI/8): no atan2 per pixel and a byte instead of a float per direction.
+Input:
+    Image im: the input image
+Output:
+    pair<Image,SectorImage>: the magnitude of the gradient in [0,1] and its direction sector
+*/
+pair<Image,SectorImage> compute_gradient_sectors(ConstImageView im)
+{
+    pair<Image,SectorImage> grad(acquire_image(im.w, im.h, 1), SectorImage(im.w, im.h));
+    compute_gradient_sectors_into(im, grad.first, grad.second);
+    return grad;
+}
 
-            // If the magnitude of the gradient of the current pixel is greater than that of both neighbors,
-            // then it is a local maximum
+void compute_gradient_sectors_into(ConstImageView im, Image& mag, SectorImage& dir)
+{
+    Image gx = acquire_image(im.w, im.h, 1);
+    Image gy = acquire_image(im.w, im.h, 1);
+    convolve_image_into(im, make_gx_filter(), false, gx);
+    convolve_image_into(im, make_gy_filter(), false, gy);
+
+    mag.reshape(im.w, im.h, 1);
+    dir.reshape(im.w, im.h);
+    parallel_for(mag.size(), [&](int i0, int i1) {
+        for (int i = i0; i < i1; ++i) {
+            mag.data[i] = gradient_magnitude(gx.data[i], gy.data[i]);
+            dir.data[i] = gradient_sector(gx.data[i], gy.data[i]);
         }
-    }
+    }, TILE_W * TILE_H);
+    feature_normalize(mag);
+    release_image(std::move(gx));
+    release_image(std::move(gy));
+}
 
-    return nms;
+
+/*
+Performs non-maximum suppression on an image, with the direction already quantized.
+Input:
+    Image mag: the magnitude of the gradient of the image [0,1]
+    SectorImage dir: the direction sector of the gradient (see compute_gradient_sectors())
+Output:
+    Image: the image after non-maximum suppression
+*/
+Image non_maximum_suppression(ConstImageView mag, const SectorImage& dir)
+{
+    assert(mag.w == dir.w && mag.h == dir.h);
+    return suppress_image(mag, quantized_direction_sectors(dir), nullptr);
+}
+
+Image non_maximum_suppression(ConstImageView mag, const SectorImage& dir, MagnitudeHistogram& hist)
+{
+    assert(mag.w == dir.w && mag.h == dir.h);
+    return suppress_image(mag, quantized_direction_sectors(dir), &hist);
+}
+
+void non_maximum_suppression_into(ConstImageView mag, const SectorImage& dir, Image& out)
+{
+    assert(mag.w == dir.w && mag.h == dir.h);
+    suppress_image(mag, quantized_direction_sectors(dir), nullptr, out);
+}
+
+void non_maximum_suppression_into(ConstImageView mag, const SectorImage& dir, MagnitudeHistogram& hist, Image& out)
+{
+    assert(mag.w == dir.w && mag.h == dir.h);
+    suppress_image(mag, quantized_direction_sectors(dir), &hist, out);
+}
+
+
+/*
+Performs non-maximum suppression on a padded magnitude image. Gives the same
+result as the Image overloads, but the neighbours are read from the halo, so
+no row or column needs clamping.
+Input:
+    PaddedImage mag: the magnitude of the gradient [0,1], with a replicated halo of at least one pixel
+    SectorImage dir: the direction sector of the gradient (see compute_gradient_sectors())
+Output:
+    Image: the image after non-maximum suppression
+*/
+Image non_maximum_suppression(const PaddedImage& mag, const SectorImage& dir)
+{
+    assert(mag.w == dir.w && mag.h == dir.h && mag.border >= 1);
+    return suppress_image(mag, quantized_direction_sectors(dir), nullptr);
+}
+
+Image non_maximum_suppression(const PaddedImage& mag, const SectorImage& dir, MagnitudeHistogram& hist)
+{
+    assert(mag.w == dir.w && mag.h == dir.h && mag.border >= 1);
+    return suppress_image(mag, quantized_direction_sectors(dir), &hist);
+}
+
+void non_maximum_suppression_into(const PaddedImage& mag, const SectorImage& dir, Image& out)
+{
+    assert(mag.w == dir.w && mag.h == dir.h && mag.border >= 1);
+    suppress_image(mag, quantized_direction_sectors(dir), nullptr, out);
+}
+
+void non_maximum_suppression_into(const PaddedImage& mag, const SectorImage& dir, MagnitudeHistogram& hist, Image& out)
+{
+    assert(mag.w == dir.w && mag.h == dir.h && mag.border >= 1);
+    suppress_image(mag, quantized_direction_sectors(dir), &hist, out);
 }
 
 
@@ -88,14 +630,91 @@ Image non_maximum_suppression(const Image& mag, const Image& dir)
     Output:
         Image: the thresholded image
 */
-Image double_thresholding(const Image& im, float lowThreshold, float highThreshold, float strongVal, float weakVal)
+Image double_thresholding(ConstImageView im, float lowThreshold, float highThreshold, float strongVal, float weakVal)
+{
+    Image res = acquire_image(im.w, im.h, im.c);
+    double_thresholding_into(im, lowThreshold, highThreshold, strongVal, weakVal, res);
+    return res;
+}
+
+// Thresholds the buffer of an rvalue input in place
+Image double_thresholding(Image&& im, float lowThreshold, float highThreshold, float strongVal, float weakVal)
 {
-    Image res(im.w, im.h, im.c);
+    double_thresholding_into(im, lowThreshold, highThreshold, strongVal, weakVal, im);
+    return std::move(im);
+}
 
-    // TODO: Your code here
-    NOT_IMPLEMENTED();
+// Pixel by pixel, so res may be the input image itself
+void double_thresholding_into(ConstImageView im, float lowThreshold, float highThreshold, float strongVal, float weakVal, Image& res)
+{
+    res.reshape(im.w, im.h, im.c);
 
-    return res;
+    // rows of all channels, the input may be a strided view
+    parallel_for(im.h * im.c, [&](int r0, int r1) {
+        for (int r = r0; r < r1; ++r) {
+            const float* in = im.RowPtr(r % im.h, r / im.h).data();
+            float* out = res.RowPtr(r % im.h, r / im.h).data();
+            for (int x = 0; x < im.w; ++x)
+                out[x] = threshold_value(in[x], lowThreshold, highThreshold, strongVal, weakVal);
+        }
+    }, TILE_H);
+}
+
+
+/*
+    Chooses the thresholds of double_thresholding() from the histogram of the
+    magnitudes after non-maximum suppression.
+    Median: low and high at (1 -+ 0.33) times the median magnitude.
+    Otsu: high at the threshold that maximizes the between-class variance
+    of the magnitudes, low at half of it; as Median when all the magnitudes
+    fall in one bin, so that high is always above 0.
+    Input:
+        MagnitudeHistogram hist: as filled by non_maximum_suppression()
+        ThresholdMethod method: Median or Otsu
+    Output:
+        pair<float,float>: the low and high thresholds
+*/
+pair<float,float> auto_thresholds(const MagnitudeHistogram& hist, ThresholdMethod method)
+{
+    const int bins = MagnitudeHistogram::BINS;
+    if (hist.total == 0) return {1, 1};
+
+    if (method == ThresholdMethod::Otsu) {
+        double sum = 0;
+        for (int i = 0; i < bins; i++) sum += (i + 0.5) * hist.counts[i];
+
+        double best = -1, sum0 = 0;
+        uint64_t n0 = 0;
+        int threshold = 0;
+        for (int i = 0; i < bins - 1; i++) {
+            n0 += hist.counts[i];
+            sum0 += (i + 0.5) * hist.counts[i];
+            uint64_t n1 = hist.total - n0;
+            if (n0 == 0 || n1 == 0) continue;
+            double mean0 = sum0 / n0, mean1 = (sum - sum0) / n1;
+            double between = double(n0) * double(n1) * (mean0 - mean1) * (mean0 - mean1);
+            if (between > best) {
+                best = between;
+                threshold = i + 1;
+            }
+        }
+        // no split with magnitudes on both sides (a single occupied bin):
+        // the median thresholds, around that bin
+        if (threshold > 0) {
+            float high = float(threshold) / bins;
+            return {0.5f * high, high};
+        }
+    }
+
+    // median, at the center of the bin where the cumulative count reaches half
+    uint64_t cumulative = 0;
+    int median = 0;
+    for (; median < bins; median++) {
+        cumulative += hist.counts[median];
+        if (2 * cumulative >= hist.total) break;
+    }
+    float v = (median + 0.5f) / bins;
+    return {std::max(0.0f, 0.67f * v), std::min(1.0f, 1.33f * v)};
 }
 
 
@@ -108,18 +727,710 @@ Image double_thresholding(const Image& im, float lowThreshold, float highThresho
     Output:
         Image: the image after hysteresis thresholding, with only strong edges
 */
-Image edge_tracking(const Image& im, float weak, float strong)
+Image edge_tracking(ConstImageView im, float weak, float strong)
+{
+    Image res = acquire_image(im.w, im.h, im.c);
+    edge_tracking_into(im, weak, strong, res);
+    return res;
+}
+
+void edge_tracking_into(ConstImageView im, float weak, float strong, Image& res)
+{
+    res.reshape(im.w, im.h, im.c);
+    if (im.c != 1) res.clear(); // only the first channel is tracked
+
+    parallel_for_tiles(im.w, im.h, [&](const Tile& t) {
+        for (int y = t.y0; y < t.y1; ++y) {
+            for (int x = t.x0; x < t.x1; ++x) {
+                float v = im(x, y);
+                if (v == strong) {
+                    res(x, y) = strong;
+                } else if (v == weak) {
+                    // A weak pixel becomes strong if any of its 8 neighbours is strong
+                    bool connected = false;
+                    for (int dy = -1; dy <= 1 && !connected; ++dy)
+                        for (int dx = -1; dx <= 1 && !connected; ++dx)
+                            connected = im.clamped_pixel(x + dx, y + dy) == strong;
+                    res(x, y) = connected ? strong : 0;
+                } else {
+                    res(x, y) = 0;
+                }
+            }
+        }
+    });
+}
+
+
+/*
+    Double thresholding into bits: the pixels >= highThreshold are set in
+    strong, those in [lowThreshold, highThreshold) in weak. Only the first
+    channel is thresholded.
+*/
+void double_thresholding_into(ConstImageView im, float lowThreshold, float highThreshold, EdgeMap& strong, EdgeMap& weak)
+{
+    strong.reshape(im.w, im.h);
+    weak.reshape(im.w, im.h);
+    parallel_for(im.h, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const float* row = im.RowPtr(y, 0).data();
+            std::span<uint64_t> s = strong.RowPtr(y), w = weak.RowPtr(y);
+            for (int i = 0; i < strong.words_per_row; ++i) {
+                const float* v = row + i * 64;
+                int n = std::min(64, im.w - i * 64);
+                uint64_t sw = 0, ww = 0;
+                for (int b = 0; b < n; ++b) {
+                    sw |= uint64_t(v[b] >= highThreshold) << b;
+                    ww |= uint64_t(v[b] >= lowThreshold) << b;
+                }
+                s[i] = sw;
+                w[i] = ww & ~sw;
+            }
+        }
+    }, TILE_H);
+}
+
+/*
+    Hysteresis on bits, as edge_tracking(): the strong pixels, and the weak
+    pixels with a strong one among their 8 neighbours. The strong rows above,
+    at and below are or-ed and dilated by one bit left and right, a word at a
+    time.
+*/
+void edge_tracking_into(const EdgeMap& strong, const EdgeMap& weak, EdgeMap& out)
+{
+    assert(strong.w == weak.w && strong.h == weak.h);
+    const int h = strong.h, n = strong.words_per_row;
+    out.reshape(strong.w, h);
+    parallel_for(h, [&](int y0, int y1) {
+        std::vector<uint64_t> d(n + 2);
+        for (int y = y0; y < y1; ++y) {
+            std::span<const uint64_t> s = strong.RowPtr(y), w = weak.RowPtr(y);
+            const uint64_t* up = y > 0 ? strong.RowPtr(y - 1).data() : nullptr;
+            const uint64_t* down = y + 1 < h ? strong.RowPtr(y + 1).data() : nullptr;
+            // d[1..n] holds the vertical dilation, d[0] and d[n+1] stay zero
+            for (int i = 0; i < n; ++i) d[i + 1] = s[i] | (up ? up[i] : 0) | (down ? down[i] : 0);
+            std::span<uint64_t> o = out.RowPtr(y);
+            for (int i = 0; i < n; ++i) {
+                uint64_t near = d[i + 1] | (d[i + 1] << 1) | (d[i] >> 63) | (d[i + 1] >> 1) | (d[i + 2] << 63);
+                o[i] = s[i] | (w[i] & near);
+            }
+        }
+    }, TILE_H);
+}
+
+EdgeMap edge_tracking(const EdgeMap& strong, const EdgeMap& weak)
+{
+    EdgeMap out;
+    edge_tracking_into(strong, weak, out);
+    return out;
+}
+
+// edge_tracking() of a thresholded float image, into bits
+void edge_tracking_into(ConstImageView im, float weak, float strong, EdgeMap& out)
+{
+    EdgeMap s(im.w, im.h), w(im.w, im.h);
+    parallel_for(im.h, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const float* row = im.RowPtr(y, 0).data();
+            std::span<uint64_t> sr = s.RowPtr(y), wr = w.RowPtr(y);
+            for (int i = 0; i < s.words_per_row; ++i) {
+                int n = std::min(64, im.w - i * 64);
+                uint64_t sw = 0, ww = 0;
+                for (int b = 0; b < n; ++b) {
+                    sw |= uint64_t(row[i * 64 + b] == strong) << b;
+                    ww |= uint64_t(row[i * 64 + b] == weak) << b;
+                }
+                sr[i] = sw;
+                wr[i] = ww;
+            }
+        }
+    }, TILE_H);
+    edge_tracking_into(s, w, out);
+}
+
+/*
+    Hysteresis into an edge list. Each word of a row is tracked as in
+    edge_tracking_into() and its bits are appended right away, lowest first,
+    with the magnitude and sector of the pixel. The rows are walked in order,
+    so the list is row-major; the pass is O(words + edges), which is why it is
+    not split into bands that would then have to be concatenated.
+*/
+template<typename Sector>
+static void track_edge_list(const EdgeMap& strong, const EdgeMap& weak, ConstImageView mag, Sector sector, EdgeList& out)
+{
+    assert(strong.w == weak.w && strong.h == weak.h && mag.w == strong.w && mag.h == strong.h);
+    const int h = strong.h, n = strong.words_per_row;
+    out.clear();
+    out.reserve(strong.count() + weak.count());
+    std::vector<uint64_t> d(n + 2);
+    for (int y = 0; y < h; ++y) {
+        std::span<const uint64_t> s = strong.RowPtr(y), w = weak.RowPtr(y);
+        const uint64_t* up = y > 0 ? strong.RowPtr(y - 1).data() : nullptr;
+        const uint64_t* down = y + 1 < h ? strong.RowPtr(y + 1).data() : nullptr;
+        for (int i = 0; i < n; ++i) d[i + 1] = s[i] | (up ? up[i] : 0) | (down ? down[i] : 0);
+        const float* m = mag.RowPtr(y, 0).data();
+        for (int i = 0; i < n; ++i) {
+            uint64_t near = d[i + 1] | (d[i + 1] << 1) | (d[i] >> 63) | (d[i + 1] >> 1) | (d[i + 2] << 63);
+            for (uint64_t bits = s[i] | (w[i] & near); bits; bits &= bits - 1) {
+                int x = i * 64 + std::countr_zero(bits);
+                out.push_back(x, y, m[x], sector(x, y));
+            }
+        }
+    }
+}
+
+void edge_tracking_into(const EdgeMap& strong, const EdgeMap& weak, ConstImageView mag, const SectorImage& dir, EdgeList& out)
+{
+    assert(dir.w == strong.w && dir.h == strong.h);
+    track_edge_list(strong, weak, mag, [&dir](int x, int y) { return dir(x, y); }, out);
+}
+
+void edge_tracking_into(const EdgeMap& strong, const EdgeMap& weak, ConstImageView mag, ConstImageView dir, EdgeList& out)
+{
+    assert(dir.w == strong.w && dir.h == strong.h);
+    track_edge_list(strong, weak, mag, [&dir](int x, int y) { return static_cast<uint8_t>(direction_sector(dir.RowPtr(y, 0)[x])); }, out);
+}
+
+
+// Union-find over pixel indices, used by edge_tracking_connected(). Roots are
+// always the smallest index of their component, so that the labels of a band
+// of rows never point outside of it until the bands are merged.
+struct PixelForest
+{
+    std::vector<int> parent;
+    std::vector<unsigned char> strong; // meaningful for roots only
+
+    explicit PixelForest(size_t n) : parent(n), strong(n) {}
+
+    int find(int p)
+    {
+        while (parent[p] != p) {
+            parent[p] = parent[parent[p]];
+            p = parent[p];
+        }
+        return p;
+    }
+
+    // read-only find, safe when several threads resolve labels at once
+    int root(int p) const
+    {
+        while (parent[p] != p) p = parent[p];
+        return p;
+    }
+
+    void unite(int a, int b)
+    {
+        a = find(a);
+        b = find(b);
+        if (a == b) return;
+        if (a > b) std::swap(a, b);
+        parent[b] = a;
+        strong[a] |= strong[b];
+    }
+};
+
+// Labels the edge pixels of rows [y0,y1) with 8-connectivity, looking at the
+// rows above only from y0+1 on, and flags the components with a strong pixel
+static void label_band(ConstImageView im, float weak, float strong, int y0, int y1, PixelForest& forest)
+{
+    const int w = im.w;
+    auto is_edge = [&](float v) { return v == weak || v == strong; };
+
+    for (int y = y0; y < y1; ++y) {
+        const float* row = im.RowPtr(y, 0).data();
+        const float* up = y > y0 ? im.RowPtr(y - 1, 0).data() : nullptr;
+        for (int x = 0; x < w; ++x) {
+            if (!is_edge(row[x])) continue;
+            int p = y * w + x;
+            forest.parent[p] = p;
+            if (x > 0 && is_edge(row[x - 1])) forest.unite(p, p - 1);
+            if (up) {
+                for (int dx = -1; dx <= 1; ++dx)
+                    if (x + dx >= 0 && x + dx < w && is_edge(up[x + dx])) forest.unite(p, p - w + dx);
+            }
+        }
+    }
+
+    for (int y = y0; y < y1; ++y) {
+        const float* row = im.RowPtr(y, 0).data();
+        for (int x = 0; x < w; ++x)
+            if (row[x] == strong) forest.strong[forest.find(y * w + x)] = 1;
+    }
+}
+
+
+/*
+    Applies hysteresis thresholding by connected components: a weak pixel is
+    kept if it is connected to a strong one through any chain of weak pixels
+    (8-connectivity), not only if it touches a strong pixel as in edge_tracking().
+    The image is split in bands of rows that are labelled in parallel with a
+    two-pass union-find, then the labels are merged across the band boundaries.
+    Input:
+        Image im: the thresholded image
+        float weak: the value of the weak edges
+        float strong: the value of the strong edges
+        int threads: number of bands, 0 for one per thread of the pool
+    Output:
+        Image: the image after hysteresis thresholding, with only strong edges
+*/
+Image edge_tracking_connected(ConstImageView im, float weak, float strong, int threads)
+{
+    Image res = acquire_image(im.w, im.h, im.c);
+    edge_tracking_connected_into(im, weak, strong, res, threads);
+    return res;
+}
+
+void edge_tracking_connected_into(ConstImageView im, float weak, float strong, Image& res, int threads)
+{
+    assert(im.c == 1);
+    res.reshape(im.w, im.h, im.c);
+    if (im.w == 0 || im.h == 0) return;
+
+    if (threads <= 0) threads = get_num_threads();
+    // bands of at least 64 rows, the merge cost is one row per band
+    int bands = std::max(1, std::min(threads, im.h / 64));
+
+    PixelForest forest(static_cast<size_t>(im.w) * im.h);
+    std::vector<int> starts(bands + 1);
+    for (int b = 0; b <= bands; ++b) starts[b] = static_cast<int>(static_cast<long long>(im.h) * b / bands);
+
+    auto run_bands = [&](auto&& body) {
+        parallel_for(bands, [&](int b0, int b1) { for (int b = b0; b < b1; ++b) body(b); });
+    };
+
+    run_bands([&](int b) { label_band(im, weak, strong, starts[b], starts[b + 1], forest); });
+
+    // merge the first row of each band with the last row of the previous one
+    for (int b = 1; b < bands; ++b) {
+        int y = starts[b];
+        const float* row = im.RowPtr(y, 0).data();
+        const float* up = im.RowPtr(y - 1, 0).data();
+        for (int x = 0; x < im.w; ++x) {
+            if (row[x] != weak && row[x] != strong) continue;
+            for (int dx = -1; dx <= 1; ++dx) {
+                if (x + dx < 0 || x + dx >= im.w) continue;
+                if (up[x + dx] == weak || up[x + dx] == strong) forest.unite(y * im.w + x, (y - 1) * im.w + x + dx);
+            }
+        }
+    }
+
+    run_bands([&](int b) {
+        for (int y = starts[b]; y < starts[b + 1]; ++y) {
+            const float* row = im.RowPtr(y, 0).data();
+            float* out = res.RowPtr(y, 0).data();
+            for (int x = 0; x < im.w; ++x) {
+                if (row[x] != weak && row[x] != strong) {
+                    out[x] = 0;
+                    continue;
+                }
+                out[x] = forest.strong[forest.root(y * im.w + x)] ? strong : 0;
+            }
+        }
+    });
+}
+
+
+// Fixed-size ring of image rows, used by canny_fused() to keep only the
+// rows that the next stage still needs
+struct RowRing
+{
+    int w;
+    std::vector<float> buf;
+
+    RowRing(int w, int rows) : w(w), buf(static_cast<size_t>(w) * rows) {}
+
+          float* row(int y)       { return buf.data() + static_cast<size_t>(y % (buf.size() / w)) * w; }
+    const float* row(int y) const { return buf.data() + static_cast<size_t>(y % (buf.size() / w)) * w; }
+};
+
+// One row of the Sobel gradient (see sobel_image()), reading the three
+// smoothed rows above, at and below y
+static void sobel_row(const float* rows[3], int w, const Image& fx, const Image& fy, float* mag, float* dir)
+{
+    for (int x = 0; x < w; ++x) {
+        float sx = 0, sy = 0;
+        for (int l = -1; l <= 1; ++l)
+            for (int m = -1; m <= 1; ++m) {
+                float a = rows[1 - m][clamp_index(x - l, w)];
+                sx += a * fx(1 - l, 1 - m);
+                sy += a * fy(1 - l, 1 - m);
+            }
+        mag[x] = gradient_magnitude(sx, sy);
+        if (dir) dir[x] = gradient_direction(sx, sy);
+    }
+}
+
+
+/*
+    Runs the whole Canny pipeline in a single streaming pass.
+    The stages of smooth_image(), compute_gradient(), non_maximum_suppression(),
+    double_thresholding() and edge_tracking() are evaluated row by row, keeping
+    only the few rows each stage needs in small ring buffers instead of
+    materializing the intermediate images. Since compute_gradient() normalizes
+    the magnitude with its global range, a first lightweight pass computes the
+    magnitude range only. With automatic thresholds the suppressed magnitudes
+    are kept in the output while their histogram is collected, and are then
+    thresholded and tracked in place, without recomputing the stages.
+    Input:
+        Image im: the grayscale input image
+        CannyParams params: smoothing sigma, thresholds and edge values
+    Output:
+        Image: the same edge map as the staged functions
+*/
+Image canny_fused(ConstImageView im, const CannyParams& params)
 {
-    Image res(im.w, im.h, im.c);
+    Image res = acquire_image(im.w, im.h, 1);
+    canny_fused_into(im, params, res);
+    return res;
+}
+
+void canny_fused_into(ConstImageView im, const CannyParams& params, Image& res)
+{
+    assert(im.c == 1);
+    const int w = im.w, h = im.h;
+    res.reshape(w, h, 1);
+    if (w == 0 || h == 0) return;
+
+    // The recursive filter runs along whole columns and cannot be streamed:
+    // for large sigma the smoothed plane is computed upfront
+    const bool recursive = params.sigma >= SMOOTH_RECURSIVE_SIGMA;
+    Image smoothed = recursive ? smooth_image_recursive(im, params.sigma) : Image();
+    Image kernel = recursive ? Image() : make_gaussian_filter_1d(params.sigma);
+    std::vector<double> tmp(w);
+
+    Image fx = make_gx_filter();
+    Image fy = make_gy_filter();
+
+    RowRing smooth(w, 3), mag(w, 3), dir(w, 3), dt(w, 3);
+    std::vector<uint8_t> sectors(w);
+    std::vector<float> nms(w);
+
+    auto smooth_row = [&](int y) {
+        if (recursive) {
+            std::span<const float> src = smoothed.RowPtr(y, 0);
+            std::copy(src.begin(), src.end(), smooth.row(y));
+        } else {
+            smooth_row_separable(im, 0, kernel, y, tmp.data(), smooth.row(y));
+        }
+    };
+
+    auto sobel = [&](int y, bool with_dir) {
+        const float* rows[3] = {smooth.row(clamp_index(y - 1, h)), smooth.row(y), smooth.row(clamp_index(y + 1, h))};
+        sobel_row(rows, w, fx, fy, mag.row(y), with_dir ? dir.row(y) : nullptr);
+    };
+
+    // Pass 1: range of the gradient magnitude
+    float min_val = INFINITY, max_val = -INFINITY;
+    for (int t = 0; t <= h; ++t) {
+        if (t < h) smooth_row(t);
+        int y = t - 1;
+        if (y >= 0) {
+            sobel(y, false);
+            const float* m = mag.row(y);
+            for (int x = 0; x < w; ++x) {
+                min_val = std::min(min_val, m[x]);
+                max_val = std::max(max_val, m[x]);
+            }
+        }
+    }
+    float range = max_val - min_val;
+
+    // Pass 2: every stage lags one row behind the previous one. With automatic
+    // thresholds the pass stops at non-maximum suppression: the suppressed
+    // rows are kept in res while their histogram is built, then thresholded
+    // and tracked in place once the thresholds are known.
+    float low = params.low, high = params.high;
+    const bool automatic = params.thresholds != ThresholdMethod::Manual;
+    MagnitudeHistogram hist;
 
-    for (int y=0; y < im.h; ++y) {
-        for (int x=0; x < im.w; ++x) {
-            // TODO: Your code here
-            NOT_IMPLEMENTED();
+    auto threshold_row = [&](const float* suppressed, int y) {
+        float* out = dt.row(y);
+        for (int x = 0; x < w; ++x) out[x] = threshold_value(suppressed[x], low, high, params.strong, params.weak);
+    };
+
+    // res row ye may hold the suppressed row ye, already thresholded into dt
+    auto track_row = [&](int ye) {
+        const float* rows[3] = {dt.row(clamp_index(ye - 1, h)), dt.row(ye), dt.row(clamp_index(ye + 1, h))};
+        std::span<float> out = res.RowPtr(ye, 0);
+        for (int x = 0; x < w; ++x) {
+            float v = rows[1][x];
+            float e = 0;
+            if (v == params.strong) {
+                e = params.strong;
+            } else if (v == params.weak) {
+                for (int dy = 0; dy < 3; ++dy)
+                    for (int dx = -1; dx <= 1; ++dx)
+                        if (rows[dy][clamp_index(x + dx, w)] == params.strong) e = params.strong;
+            }
+            out[x] = e;
+        }
+    };
+
+    for (int t = 0; t < h + (automatic ? 2 : 3); ++t) {
+        if (t < h) smooth_row(t);
+
+        int ys = t - 1;
+        if (ys >= 0 && ys < h) {
+            sobel(ys, true);
+            if (range) {
+                float* m = mag.row(ys);
+                for (int x = 0; x < w; ++x) m[x] = (m[x] - min_val) / range;
+            }
+        }
 
-            // Hint: use clamped_pixel when checking the neighbors to avoid going out of bounds
+        int yn = t - 2;
+        if (yn >= 0 && yn < h) {
+            const float* d = dir.row(yn);
+            for (int x = 0; x < w; ++x) sectors[x] = direction_sector(d[x]);
+            float* suppressed = automatic ? res.RowPtr(yn, 0).data() : nms.data();
+            suppress_row(mag.row(clamp_index(yn - 1, h)), mag.row(yn), mag.row(clamp_index(yn + 1, h)),
+                         sectors.data(), w, suppressed);
+            if (automatic) {
+                for (int x = 0; x < w; ++x)
+                    if (suppressed[x] > 0) hist.add(suppressed[x]);
+            } else {
+                threshold_row(suppressed, yn);
+            }
         }
+
+        int ye = t - 3;
+        if (!automatic && ye >= 0 && ye < h) track_row(ye);
+    }
+
+    if (automatic) {
+        std::tie(low, high) = auto_thresholds(hist, params.thresholds);
+        for (int t = 0; t <= h; ++t) {
+            if (t < h) threshold_row(res.RowPtr(t, 0).data(), t);
+            if (t > 0) track_row(t - 1);
+        }
+    }
+    release_image(std::move(smoothed));
+}
+
+/*
+    Canny edge detection into an edge list: the stages of canny(), with the
+    thresholds and the hysteresis on bits and the edges read from the
+    suppressed magnitude and the gradient sectors.
+*/
+EdgeList canny_edge_list(ConstImageView im, const CannyParams& params)
+{
+    assert(im.c == 1);
+    Image smoothed = smooth_image(im, params.sigma);
+    Image mag = acquire_image(im.w, im.h, 1);
+    SectorImage dir;
+    compute_gradient_sectors_into(smoothed, mag, dir);
+    release_image(std::move(smoothed));
+
+    float low = params.low, high = params.high;
+    Image nms = acquire_image(im.w, im.h, 1);
+    if (params.thresholds != ThresholdMethod::Manual) {
+        MagnitudeHistogram hist;
+        non_maximum_suppression_into(mag, dir, hist, nms);
+        std::tie(low, high) = auto_thresholds(hist, params.thresholds);
+    } else {
+        non_maximum_suppression_into(mag, dir, nms);
+    }
+    release_image(std::move(mag));
+
+    EdgeMap strong, weak;
+    double_thresholding_into(nms, low, high, strong, weak);
+    EdgeList edges;
+    edge_tracking_into(strong, weak, nms, dir, edges);
+    release_image(std::move(nms));
+    return edges;
+}
+
+
+// Fractional bits of the fixed-point Gaussian weights of the u8 smoothing
+static const int SMOOTH_Q = 14;
+
+// Rounds the 1D Gaussian to integer weights that sum exactly to 1 << q,
+// the rounding error going to the center tap
+static std::vector<int16_t> fixed_point_kernel(const Image& kernel, int q)
+{
+    std::vector<int16_t> k(kernel.w);
+    int sum = 0;
+    for (int i = 0; i < kernel.w; ++i) {
+        k[i] = lroundf(kernel.data[i] * (1 << q));
+        sum += k[i];
     }
+    k[kernel.w / 2] += (1 << q) - sum;
+    return k;
+}
+
+
+/*
+Smooths an 8-bit image with the separable Gaussian of make_gaussian_filter_1d(sigma),
+in fixed point: weights with 14 fractional bits, the vertical pass kept with 7
+fractional bits in 16 bits, the horizontal pass accumulated in 32 bits and
+rounded to the nearest integer. All products are 16 x 16 bits, which vectorize
+on any x86-64. Borders are clamped.
+Input:
+    ImageU8 im: the input image
+    float sigma: the standard deviation of the Gaussian kernel
+Output:
+    ImageU8: the smoothed image (im.w, im.h, im.c)
+*/
+ImageU8 smooth_image(const ImageU8& im, float sigma)
+{
+    Image kernel = make_gaussian_filter_1d(sigma);
+    const std::vector<int16_t> weights = fixed_point_kernel(kernel, SMOOTH_Q);
+    const int16_t* k = weights.data() + kernel.w / 2;
+    ImageU8 res(im.w, im.h, im.c);
+
+    for (int ch = 0; ch < im.c; ++ch) {
+        parallel_for(im.h, [&](int y0, int y1) {
+            // local copies: the int32 stores could alias captured ints
+            const int w = im.w, r = kernel.w / 2;
+            std::vector<int32_t> acc(w);
+            std::vector<int16_t> tmp(w);
+            for (int y = y0; y < y1; ++y) {
+                std::fill(acc.begin(), acc.end(), 0);
+                for (int m = -r; m <= r; ++m) {
+                    const uint8_t* src = im.RowPtr(clamp_index(y + m, im.h), ch).data();
+                    const int16_t km = k[m];
+                    for (int x = 0; x < w; ++x) acc[x] += static_cast<int16_t>(src[x]) * km;
+                }
+                // at most 255 << 7, 7 fractional bits
+                for (int x = 0; x < w; ++x) tmp[x] = (acc[x] + (1 << (SMOOTH_Q - 8))) >> (SMOOTH_Q - 7);
+
+                // horizontal pass, tap by tap over the columns that need no clamping
+                const int x0 = std::min(r, w), x1 = std::max(x0, w - r);
+                std::fill(acc.begin(), acc.end(), 0);
+                for (int l = -r; l <= r; ++l) {
+                    const int16_t kl = k[l];
+                    for (int x = x0; x < x1; ++x) acc[x] += tmp[x + l] * kl;
+                }
+                auto border = [&](int x) {
+                    for (int l = -r; l <= r; ++l) acc[x] += tmp[clamp_index(x + l, w)] * k[l];
+                };
+                for (int x = 0; x < x0; ++x) border(x);
+                for (int x = x1; x < w; ++x) border(x);
+
+                uint8_t* out = res.RowPtr(y, ch).data();
+                for (int x = 0; x < w; ++x) out[x] = (acc[x] + (1 << (SMOOTH_Q + 6))) >> (SMOOTH_Q + 7);
+            }
+        }, TILE_H);
+    }
+
     return res;
+}
+
+
+/*
+Computes the Sobel responses of an 8-bit grayscale image in 16-bit integers.
+The taps are those of make_gx_filter() and make_gy_filter() without the 1/8
+normalization, so the results are exact and lie in [-1020, 1020].
+Input:
+    ImageU8 im: the input image
+Output:
+    pair<ImageS16,ImageS16>: the horizontal and vertical responses
+*/
+pair<ImageS16,ImageS16> sobel_image_s16(const ImageU8& im)
+{
+    assert(im.c == 1);
+    const int w = im.w, h = im.h;
+    ImageS16 gx(w, h, 1), gy(w, h, 1);
+    if (w == 0 || h == 0) return {std::move(gx), std::move(gy)};
 
+    // taps[1+v][1+u] weighs the pixel (x+u, y+v), as in convolve_image()
+    Image fx = make_gx_filter(), fy = make_gy_filter();
+    int tx[3][3], ty[3][3];
+    for (int v = -1; v <= 1; ++v)
+        for (int u = -1; u <= 1; ++u) {
+            tx[1 + v][1 + u] = lroundf(fx(1 + u, 1 + v) * 8);
+            ty[1 + v][1 + u] = lroundf(fy(1 + u, 1 + v) * 8);
+        }
+
+    parallel_for(h, [&](int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const uint8_t* rows[3] = {im.RowPtr(clamp_index(y - 1, h), 0).data(), im.RowPtr(y, 0).data(),
+                                      im.RowPtr(clamp_index(y + 1, h), 0).data()};
+            int16_t* ox = gx.RowPtr(y, 0).data();
+            int16_t* oy = gy.RowPtr(y, 0).data();
+            auto pixel = [&](int x, auto column) {
+                int sx = 0, sy = 0;
+                for (int v = 0; v < 3; ++v)
+                    for (int u = -1; u <= 1; ++u) {
+                        int a = rows[v][column(x + u)];
+                        sx += a * tx[v][1 + u];
+                        sy += a * ty[v][1 + u];
+                    }
+                ox[x] = sx;
+                oy[x] = sy;
+            };
+            auto clamped = [&](int x) { return clamp_index(x, w); };
+            auto inside = [](int x) { return x; };
+            pixel(0, clamped);
+            for (int x = 1; x < w - 1; ++x) pixel(x, inside);
+            if (w > 1) pixel(w - 1, clamped);
+        }
+    }, TILE_H);
+
+    return {std::move(gx), std::move(gy)};
+}
+
+
+/*
+Same as compute_gradient_sectors(), from an 8-bit image through the int16 Sobel
+responses of sobel_image_s16(): the magnitude is normalized to [0,1] and the
+sectors are computed from the integer responses.
+Input:
+    ImageU8 im: the input image
+Output:
+    pair<Image,SectorImage>: the magnitude of the gradient in [0,1] and its direction sector
+*/
+pair<Image,SectorImage> compute_gradient_sectors(const ImageU8& im)
+{
+    pair<ImageS16,ImageS16> g = sobel_image_s16(im);
+    const std::vector<int16_t>& gx = g.first.data;
+    const std::vector<int16_t>& gy = g.second.data;
+
+    Image mag = acquire_image(im.w, im.h, 1);
+    SectorImage dir(im.w, im.h);
+    parallel_for(mag.size(), [&](int i0, int i1) {
+        for (int i = i0; i < i1; ++i) {
+            int sx = gx[i], sy = gy[i];
+            mag.data[i] = sqrtf(static_cast<float>(sx * sx + sy * sy));
+            dir.data[i] = gradient_sector(sx, sy);
+        }
+    }, TILE_W * TILE_H);
+    feature_normalize(mag);
+
+    return {std::move(mag), std::move(dir)};
+}
+
+
+/*
+Runs the Canny pipeline on an 8-bit grayscale image: smoothing in u8, Sobel
+in int16, and the float stages from the normalized magnitude on. The
+intermediate images up to the gradient take 1 and 2 bytes per pixel instead
+of 4; the result differs from the float pipeline by the rounding of the
+smoothed image.
+Input:
+    ImageU8 im: the grayscale input image
+    CannyParams params: smoothing sigma, thresholds and edge values
+Output:
+    Image: the edge map, with params.strong on the edges and 0 elsewhere
+*/
+Image canny_u8(const ImageU8& im, const CannyParams& params)
+{
+    assert(im.c == 1);
+    pair<Image,SectorImage> grad = compute_gradient_sectors(smooth_image(im, params.sigma));
+
+    float low = params.low, high = params.high;
+    Image nms;
+    if (params.thresholds != ThresholdMethod::Manual) {
+        MagnitudeHistogram hist;
+        nms = non_maximum_suppression(grad.first, grad.second, hist);
+        std::tie(low, high) = auto_thresholds(hist, params.thresholds);
+    } else {
+        nms = non_maximum_suppression(grad.first, grad.second);
+    }
+    release_image(std::move(grad.first));
+
+    Image dt = double_thresholding(nms, low, high, params.strong, params.weak);
+    release_image(std::move(nms));
+    Image res = edge_tracking(dt, params.weak, params.strong);
+    release_image(std::move(dt));
+    return res;
 }
@@ -0,0 +1,215 @@
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+#include "../include/edge_map.h"
+#include "../include/parallel.h"
+
+size_t EdgeMap::count(void) const
+  {
+  size_t n = 0;
+  for (uint64_t word : data) n += std::popcount(word);
+  return n;
+  }
+
+EdgeMap to_edge_map(ConstImageView im)
+  {
+  EdgeMap edges(im.w, im.h);
+  parallel_for(im.h, [&](int y0, int y1) {
+    for (int y = y0; y < y1; y++)
+      {
+      const float* row = im.RowPtr(y, 0).data();
+      std::span<uint64_t> bits = edges.RowPtr(y);
+      for (int i = 0; i < edges.words_per_row; i++)
+        {
+        int x0 = i * 64, n = std::min(64, im.w - x0);
+        uint64_t word = 0;
+        for (int b = 0; b < n; b++) word |= uint64_t(row[x0 + b] != 0) << b;
+        bits[i] = word;
+        }
+      }
+  }, TILE_H);
+  return edges;
+  }
+
+Image to_image(const EdgeMap& edges, float value)
+  {
+  Image im(edges.w, edges.h, 1);
+  parallel_for(edges.h, [&](int y0, int y1) {
+    for (int y = y0; y < y1; y++)
+      {
+      std::span<const uint64_t> bits = edges.RowPtr(y);
+      float* row = im.RowPtr(y, 0).data();
+      for (int x = 0; x < edges.w; x++) row[x] = (bits[x >> 6] >> (x & 63)) & 1 ? value : 0.0f;
+      }
+  }, TILE_H);
+  return im;
+  }
+
+// First x in [from, w) whose bit is v, w if none
+static int find_bit(std::span<const uint64_t> row, int from, int w, bool v)
+  {
+  int i = from >> 6;
+  if (i >= static_cast<int>(row.size())) return w;
+  uint64_t word = (v ? row[i] : ~row[i]) & (~uint64_t(0) << (from & 63));
+  while (!word)
+    {
+    if (++i == static_cast<int>(row.size())) return w;
+    word = v ? row[i] : ~row[i];
+    }
+  return std::min(w, i * 64 + std::countr_zero(word));
+  }
+
+// Sets the bits [x0, x1) of a row
+static void set_bits(std::span<uint64_t> row, int x0, int x1)
+  {
+  while (x0 < x1)
+    {
+    int i = x0 >> 6, b0 = x0 & 63, b1 = std::min(64, b0 + (x1 - x0));
+    uint64_t mask = (b1 == 64 ? ~uint64_t(0) : (uint64_t(1) << b1) - 1) & (~uint64_t(0) << b0);
+    row[i] |= mask;
+    x0 += b1 - b0;
+    }
+  }
+
+static void put_varint(std::vector<uint8_t>& out, uint64_t v)
+  {
+  while (v >= 0x80)
+    {
+    out.push_back(static_cast<uint8_t>(v) | 0x80);
+    v >>= 7;
+    }
+  out.push_back(static_cast<uint8_t>(v));
+  }
+
+static uint64_t get_varint(std::span<const uint8_t> in, size_t& pos)
+  {
+  uint64_t v = 0;
+  for (int shift = 0; shift < 64; shift += 7)
+    {
+    if (pos >= in.size()) throw std::runtime_error("Truncated run-length encoded edge map");
+    uint8_t b = in[pos++];
+    v |= uint64_t(b & 0x7f) << shift;
+    if (!(b & 0x80)) return v;
+    }
+  throw std::runtime_error("Invalid run-length encoded edge map");
+  }
+
+std::vector<uint8_t> encode_rle(const EdgeMap& edges)
+  {
+  std::vector<uint8_t> out;
+  uint64_t run_start = 0;
+  bool v = false;
+  for (int y = 0; y < edges.h; y++)
+    {
+    std::span<const uint64_t> row = edges.RowPtr(y);
+    uint64_t row_start = static_cast<uint64_t>(y) * edges.w;
+    for (int x = find_bit(row, 0, edges.w, !v); x < edges.w; x = find_bit(row, x, edges.w, !v))
+      {
+      put_varint(out, row_start + x - run_start);
+      run_start = row_start + x;
+      v = !v;
+      }
+    }
+  put_varint(out, static_cast<uint64_t>(edges.w) * edges.h - run_start);
+  return out;
+  }
+
+EdgeMap decode_rle(std::span<const uint8_t> rle, int w, int h)
+  {
+  EdgeMap edges(w, h);
+  const uint64_t total = static_cast<uint64_t>(w) * h;
+  uint64_t pos = 0;
+  size_t in = 0;
+  bool v = false;
+  while (in < rle.size())
+    {
+    uint64_t run = get_varint(rle, in);
+    if (run > total - pos) throw std::runtime_error("Run-length encoded edge map larger than its size");
+    for (uint64_t end = pos + run; v && pos < end; )
+      {
+      int y = pos / w, x0 = pos % w;
+      int x1 = static_cast<int>(std::min<uint64_t>(w, x0 + (end - pos)));
+      set_bits(edges.RowPtr(y), x0, x1);
+      pos += x1 - x0;
+      }
+    pos += v ? 0 : run;
+    v = !v;
+    }
+  if (pos != total) throw std::runtime_error("Run-length encoded edge map smaller than its size");
+  return edges;
+  }
+
+
+struct EdgeMapHeader
+  {
+  static constexpr char MAGIC[4] = {'S', 'R', 'E', 'M'};
+  static constexpr uint32_t VERSION = 1;
+
+  char magic[4];
+  uint32_t version;
+  EdgeMapEncoding encoding;
+  int32_t w, h;
+  uint32_t reserved;
+  uint64_t payload_bytes;
+  };
+
+void save_edge_map(const EdgeMap& edges, const std::string& filename, EdgeMapEncoding encoding)
+  {
+  std::vector<uint8_t> rle;
+  if (encoding == EdgeMapEncoding::RLE) rle = encode_rle(edges);
+
+  EdgeMapHeader hd = {};
+  memcpy(hd.magic, EdgeMapHeader::MAGIC, sizeof(hd.magic));
+  hd.version = EdgeMapHeader::VERSION;
+  hd.encoding = encoding;
+  hd.w = edges.w;
+  hd.h = edges.h;
+  hd.payload_bytes = encoding == EdgeMapEncoding::RLE ? rle.size() : edges.data.size() * sizeof(uint64_t);
+  const void* payload = encoding == EdgeMapEncoding::RLE ? static_cast<const void*>(rle.data()) : edges.data.data();
+
+  FILE* fn = fopen(filename.c_str(), "wb");
+  if (!fn) throw std::runtime_error("Cannot open file: " + filename);
+  bool ok = fwrite(&hd, sizeof(hd), 1, fn) == 1 && fwrite(payload, 1, hd.payload_bytes, fn) == hd.payload_bytes;
+  ok = (fclose(fn) == 0) && ok;
+  if (!ok) throw std::runtime_error("Cannot write edge map: " + filename);
+  }
+
+EdgeMap load_edge_map(const std::string& filename)
+  {
+  FILE* fn = fopen(filename.c_str(), "rb");
+  if (!fn) throw std::runtime_error("Cannot open file: " + filename);
+  EdgeMapHeader hd;
+  bool ok = fread(&hd, sizeof(hd), 1, fn) == 1
+         && memcmp(hd.magic, EdgeMapHeader::MAGIC, sizeof(hd.magic)) == 0
+         && hd.version == EdgeMapHeader::VERSION
+         && hd.w >= 0 && hd.h >= 0;
+  // the payload must be in the file before anything is allocated for it
+  struct stat st;
+  ok = ok && fstat(fileno(fn), &st) == 0
+          && hd.payload_bytes <= static_cast<uint64_t>(st.st_size) - sizeof(hd);
+  std::vector<uint8_t> payload;
+  EdgeMap edges;
+  if (ok && hd.encoding == EdgeMapEncoding::Bits)
+    {
+    ok = hd.payload_bytes == static_cast<uint64_t>((static_cast<int64_t>(hd.w) + 63) / 64) * hd.h * sizeof(uint64_t);
+    if (ok) edges = EdgeMap(hd.w, hd.h);
+    ok = ok && fread(edges.data.data(), 1, hd.payload_bytes, fn) == hd.payload_bytes;
+    // keep the bits past w zero whatever the file holds
+    if (ok && hd.w % 64)
+      for (int y = 0; y < edges.h; y++) edges.RowPtr(y).back() &= (uint64_t(1) << (hd.w % 64)) - 1;
+    }
+  else if (ok && hd.encoding == EdgeMapEncoding::RLE)
+    {
+    payload.resize(hd.payload_bytes);
+    ok = fread(payload.data(), 1, payload.size(), fn) == payload.size();
+    }
+  else ok = false;
+  fclose(fn);
+  if (!ok) throw std::runtime_error("Cannot read edge map: " + filename);
+  if (hd.encoding == EdgeMapEncoding::RLE) edges = decode_rle(payload, hd.w, hd.h);
+  return edges;
+  }
@@ -4,6 +4,8 @@
 #include <math.h>
 #include <assert.h>
 #include "../include/image.h"
+#include "../include/parallel.h"
+#include "../include/image_pool.h"
 
 #include <Eigen/Core>
 #include <Eigen/Dense>
@@ -52,61 +54,80 @@ Image make_box_filter(int w) {
     return filter;
 }
 
-// HW1 #2.2
-// const Image&im: input image
+// Convolution of an already padded image
+// const PaddedImage& im: input image, with a halo of at least filter.w/2 pixels
 // const Image& filter: filter to convolve with
 // bool preserve: whether to preserve number of channels
-// returns the convolved image
-Image convolve_image(const Image &im, const Image &filter, bool preserve) {
+// Image& ret: the convolved image, reshaped to (im.w, im.h, preserve ? im.c : 1)
+static void convolve_padded(const PaddedImage &im, const Image &filter, bool preserve, Image &ret) {
     assert(filter.c == 1);
     int filter_offset = filter.w / 2;
-    Image ret;
-    if (preserve) {
-        ret = Image(im.w, im.h, im.c);
-    } else {
-        ret = Image(im.w, im.h, 1);
-    }
-    // This is the case when we need to use the function clamped_pixel(x,y,c).
-    // Otherwise you'll have to manually check whether the filter goes out of bounds
-
-    // for each pixel in im
-    for (int i = 0; i < im.w; ++i) {
-        for (int j = 0; j < im.h; ++j) {
+    assert(im.border >= filter_offset);
+    // every pixel is written, the buffer may come from the image pool
+    ret.reshape(im.w, im.h, preserve ? im.c : 1);
+    // The halo holds the values clamped_pixel(x,y,c) would return, so the
+    // taps are plain pointer offsets. Each output row of a tile is accumulated
+    // in a row buffer, adding the taps in the same order as a per-pixel sum.
+    vector<float> taps;
+    for (int l = -filter_offset; l <= filter_offset; ++l)
+        for (int m = -filter_offset; m <= filter_offset; ++m)
+            taps.push_back(filter(filter_offset - l, filter_offset - m));
+
+    // for each pixel in im, one tile of the output at a time
+    parallel_for_tiles(im.w, im.h, [&](const Tile& t) {
+        int n = t.x1 - t.x0;
+        vector<float> sum(n);
+        for (int j = t.y0; j < t.y1; ++j) {
             if (preserve) {
                 for (int k = 0; k < im.c; ++k) {
-                    float sum = 0;
+                    std::fill(sum.begin(), sum.end(), 0.0f);
+                    const float* b = taps.data();
                     for (int l = -filter_offset; l <= filter_offset; ++l) {
-                        for (int m = -filter_offset; m <= filter_offset; ++m) {
-                            float a = im.clamped_pixel(i - l, j - m, k);
-                            float b = filter(filter_offset - l,
-                                             filter_offset - m);
-                            sum += a * b;
+                        for (int m = -filter_offset; m <= filter_offset; ++m, ++b) {
+                            const float* a = im.RowPtr(j - m, k).data() + t.x0 - l;
+                            for (int i = 0; i < n; ++i) sum[i] += a[i] * *b;
                         }
-                    } //end for k
-                    ret(i, j, k) = sum;
+                    }
+                    std::copy(sum.begin(), sum.end(), ret.RowPtr(j, k).begin() + t.x0);
                 }
             } else {
-
-                float sum = 0;
+                std::fill(sum.begin(), sum.end(), 0.0f);
+                const float* b = taps.data();
                 for (int l = -filter_offset; l <= filter_offset; ++l) {
-                    for (int m = -filter_offset; m <= filter_offset; ++m) {
+                    for (int m = -filter_offset; m <= filter_offset; ++m, ++b) {
                         for (int k = 0; k < im.c; ++k) {
-                            float a = im.clamped_pixel(i - l, j - m, k);
-                            float b = filter(filter_offset - l,
-                                             filter_offset - m);
-                            sum += a * b;
+                            const float* a = im.RowPtr(j - m, k).data() + t.x0 - l;
+                            for (int i = 0; i < n; ++i) sum[i] += a[i] * *b;
                         }
                     }
                 }
-                ret(i, j, 0) = sum;
-
+                std::copy(sum.begin(), sum.end(), ret.RowPtr(j, 0).begin() + t.x0);
             }
         }
-    }
+    });
+}
 
+// HW1 #2.2
+// const Image&im: input image
+// const Image& filter: filter to convolve with
+// bool preserve: whether to preserve number of channels
+// returns the convolved image
+Image convolve_image(ConstImageView im, const Image &filter, bool preserve) {
+    Image ret = acquire_image(im.w, im.h, preserve ? im.c : 1);
+    convolve_image_into(im, filter, preserve, ret);
     return ret;
 }
 
+// Same as convolve_image(), into out
+void convolve_image_into(ConstImageView im, const Image &filter, bool preserve, Image &out) {
+    assert(filter.c == 1);
+    // replicated halo: the same values clamped_pixel(x,y,c) would return
+    PaddedImage padded = acquire_padded_image(im.w, im.h, im.c, filter.w / 2);
+    padded.assign(im, BorderMode::Replicate);
+    convolve_padded(padded, filter, preserve, out);
+    release_image(std::move(padded));
+}
+
 // HW1 #2.2+ Fast convolution
 // Functions for matrix to image and image to matrix conversion:
 Eigen::MatrixXd imageToMatrix(const Image& img, int ch, int kernel, bool pad) {
@@ -305,6 +326,23 @@ Image make_gaussian_filter(float sigma) {
 
 }
 
+// float sigma: sigma for the gaussian filter
+// returns the 1D gaussian filter (size x 1) whose outer product with itself
+// is make_gaussian_filter(sigma), for separable convolution
+Image make_gaussian_filter_1d(float sigma) {
+    int range = round(sigma * 3);
+    int size = range * 2 + 1;
+
+    Image filter(size, 1, 1);
+    double sigma2 = sigma * sigma;
+    for (int l = 0; l < size; ++l) {
+        float x = l - range;
+        filter(l, 0, 0) = exp(-(x * x) / (2 * sigma2));
+    }
+    l1_normalize(filter);
+    return filter;
+}
+
 
 // HW1 #3
 // const Image& a: input image
@@ -314,16 +352,8 @@ Image add_image(const Image &a, const Image &b) {
     assert(a.w == b.w && a.h == b.h &&
            a.c == b.c); // assure images are the same size
 
-    Image result(a.w, a.h, a.c);
-    for (int i = 0; i < a.w; ++i) {
-        for (int j = 0; j < a.h; ++j) {
-            for (int k = 0; k < a.c; ++k) {
-                result(i, j, k) = a(i, j, k) + b(i, j, k);
-            }
-        }
-    }
-
-    return result;
+    // one fused pass, see image_expr.h
+    return a + b;
 
 }
 
@@ -335,16 +365,7 @@ Image sub_image(const Image &a, const Image &b) {
     assert(a.w == b.w && a.h == b.h &&
            a.c == b.c); // assure images are the same size
 
-    Image result(a.w, a.h, a.c);
-    for (int i = 0; i < a.w; ++i) {
-        for (int j = 0; j < a.h; ++j) {
-            for (int k = 0; k < a.c; ++k) {
-                result(i, j, k) = a(i, j, k) - b(i, j, k);
-            }
-        }
-    }
-
-    return result;
+    return a - b;
 
 }
 
@@ -405,6 +426,13 @@ void feature_normalize(Image &im) {
 
 }
 
+// Image&& im: input image, normalized in place
+// returns im
+Image feature_normalize(Image &&im) {
+    feature_normalize(im);
+    return std::move(im);
+}
+
 
 // Normalizes features across all channels
 void feature_normalize_total(Image &im) {
@@ -425,23 +453,42 @@ void feature_normalize_total(Image &im) {
 // HW1 #4.3
 // Image& im: input image
 // return a pair of images of the same size
-pair<Image, Image> sobel_image(const Image &im) {
+pair<Image, Image> sobel_image(ConstImageView im) {
+    pair<Image, Image> ret(acquire_image(im.w, im.h, 1), acquire_image(im.w, im.h, 1));
+    sobel_image_into(im, ret.first, ret.second);
+    return ret;
+}
+
+// Same as sobel_image(), into mod and theta
+void sobel_image_into(ConstImageView im, Image &mod, Image &theta) {
     Image fx = make_gx_filter();
     Image fy = make_gy_filter();
-    Image Gx = convolve_image(im, fx, false);
-    Image Gy = convolve_image(im, fy, false);
-
-    Image mod(im.w, im.h, 1);
-    Image theta(im.w, im.h, 1);
-    for (int i = 0; i < im.w; ++i) {
-        for (int j = 0; j < im.h; ++j) {
-            double gx = Gx(i, j, 0);
-            double gy = Gy(i, j, 0);
-            mod(i, j, 0) = sqrtf(pow(gx, 2) + pow(gy, 2));
-            theta(i, j, 0) = atan2f(gy, gx);
+    PaddedImage padded = acquire_padded_image(im.w, im.h, im.c, 1);
+    padded.assign(im, BorderMode::Replicate);
+    Image Gx = acquire_image(im.w, im.h, 1);
+    Image Gy = acquire_image(im.w, im.h, 1);
+    convolve_padded(padded, fx, false, Gx);
+    convolve_padded(padded, fy, false, Gy);
+    release_image(std::move(padded));
+
+    mod.reshape(im.w, im.h, 1);
+    theta.reshape(im.w, im.h, 1);
+    parallel_for_tiles(im.w, im.h, [&](const Tile& t) {
+        for (int j = t.y0; j < t.y1; ++j) {
+            const float* gx_row = Gx.RowPtr(j, 0).data();
+            const float* gy_row = Gy.RowPtr(j, 0).data();
+            float* mod_row = mod.RowPtr(j, 0).data();
+            float* theta_row = theta.RowPtr(j, 0).data();
+            for (int i = t.x0; i < t.x1; ++i) {
+                double gx = gx_row[i];
+                double gy = gy_row[i];
+                mod_row[i] = sqrtf(pow(gx, 2) + pow(gy, 2));
+                theta_row[i] = atan2f(gy, gx);
+            }
         }
-    }
-    return {mod, theta};
+    });
+    release_image(std::move(Gx));
+    release_image(std::move(Gy));
 }
 
 
@@ -673,6 +720,3 @@ void Image::feature_normalize_total(void) { ::feature_normalize_total(*this); }
 
 void Image::l1_normalize(void) { ::l1_normalize(*this); }
 
-Image operator-(const Image &a, const Image &b) { return sub_image(a, b); }
-
-Image operator+(const Image &a, const Image &b) { return add_image(a, b); }
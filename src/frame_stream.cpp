@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <stdexcept>
+
+#include "../include/frame_stream.h"
+#include "../include/simd.h"
+
+// Skips whitespace and '#' comments, then reads a decimal PNM header field.
+// The single whitespace character after the field is consumed too.
+static int read_pnm_field(FILE* in)
+{
+    int c = getc(in);
+    while (c == '#' || isspace(c)) {
+        if (c == '#') while (c != '\n' && c != EOF) c = getc(in);
+        c = getc(in);
+    }
+    if (!isdigit(c)) throw std::runtime_error("Invalid PNM frame header");
+    long v = 0;
+    for (; isdigit(c); c = getc(in)) {
+        v = v * 10 + (c - '0');
+        if (v > 1 << 30) throw std::runtime_error("Invalid PNM frame header");
+    }
+    if (!isspace(c)) throw std::runtime_error("Invalid PNM frame header");
+    return v;
+}
+
+// Rest of the current line, without the '\n'
+static std::string read_line(FILE* in)
+{
+    std::string line;
+    for (int c = getc(in); c != '\n'; c = getc(in)) {
+        if (c == EOF) throw std::runtime_error("Truncated Y4M stream");
+        line += static_cast<char>(c);
+    }
+    return line;
+}
+
+// Value of a Y4M W or H tag, a decimal number from 1 to 2^30
+static int read_y4m_size(const std::string& tag)
+{
+    char* end;
+    errno = 0;
+    long v = strtol(tag.c_str() + 1, &end, 10);
+    if (errno || end == tag.c_str() + 1 || *end || v < 1 || v > 1 << 30)
+        throw std::runtime_error("Invalid Y4M stream header");
+    return v;
+}
+
+static void read_bytes(FILE* in, std::vector<unsigned char>& bytes, size_t n)
+{
+    bytes.resize(n);
+    if (fread(bytes.data(), 1, n, in) != n) throw std::runtime_error("Truncated frame");
+}
+
+bool FrameReader::read(Image& frame)
+{
+    if (y4m) return read_y4m(frame);
+    int c = getc(in);
+    while (isspace(c)) c = getc(in);
+    if (c == EOF) return false;
+    if (c == 'P') {
+        int magic = getc(in);
+        if (magic == '5' || magic == '6') return read_pnm(frame, magic);
+    }
+    else if (c == 'Y' && count == 0) {
+        read_y4m_header();
+        return read_y4m(frame);
+    }
+    throw std::runtime_error("Unknown frame format, expected binary PGM/PPM or YUV4MPEG2");
+}
+
+bool FrameReader::read_pnm(Image& frame, int magic)
+{
+    const int w = read_pnm_field(in), h = read_pnm_field(in), max = read_pnm_field(in);
+    if (max < 1 || max > 65535) throw std::runtime_error("Invalid PNM maximum value");
+    const int channels = magic == '6' ? 3 : 1;
+    const size_t n = static_cast<size_t>(w) * h;
+    if (n > MAX_PIXELS) throw std::runtime_error("PNM frame too large");
+    const int sample_bytes = max > 255 ? 2 : 1;
+    read_bytes(in, bytes, n * channels * sample_bytes);
+
+    if (max != maxval) {
+        maxval = max;
+        values.resize(max + 1);
+        for (int v = 0; v <= max; v++) values[v] = static_cast<float>(v) / static_cast<float>(max);
+    }
+    auto sample = [&](size_t i) -> float {
+        int v = sample_bytes == 1 ? bytes[i] : (bytes[2 * i] << 8) | bytes[2 * i + 1];
+        return values[std::min(v, max)];
+    };
+
+    frame.reshape(w, h, 1);
+    float* dst = frame.data.data();
+    if (channels == 1)
+        for (size_t i = 0; i < n; i++) dst[i] = sample(i);
+    else
+        for (size_t i = 0; i < n; i++)
+            dst[i] = 0.299 * sample(3 * i) + 0.587 * sample(3 * i + 1) + 0.114 * sample(3 * i + 2);
+    fmt = channels == 1 ? FrameFormat::PGM : FrameFormat::PPM;
+    count++;
+    return true;
+}
+
+void FrameReader::read_y4m_header(void)
+{
+    // the 'Y' of the signature has been read
+    std::string line = read_line(in);
+    if (line.compare(0, 8, "UV4MPEG2") != 0) throw std::runtime_error("Unknown frame format, expected binary PGM/PPM or YUV4MPEG2");
+
+    std::string colorspace = "420jpeg";
+    size_t pos = 8;
+    while (pos < line.size()) {
+        size_t end = line.find(' ', pos);
+        if (end == std::string::npos) end = line.size();
+        std::string tag = line.substr(pos, end - pos);
+        pos = end + 1;
+        if (tag.empty()) continue;
+        switch (tag[0]) {
+            case 'W': y4m_w = read_y4m_size(tag); break;
+            case 'H': y4m_h = read_y4m_size(tag); break;
+            case 'C': colorspace = tag.substr(1); break;
+            case 'F': case 'A': case 'I': params += (params.empty() ? "" : " ") + tag; break;
+        }
+    }
+    if (y4m_w <= 0 || y4m_h <= 0) throw std::runtime_error("Invalid Y4M stream header");
+    if (static_cast<size_t>(y4m_w) * y4m_h > MAX_PIXELS) throw std::runtime_error("Y4M frame too large");
+
+    const size_t w = y4m_w, h = y4m_h;
+    if (colorspace == "420" || colorspace == "420jpeg" || colorspace == "420paldv" || colorspace == "420mpeg2")
+        y4m_chroma = 2 * ((w + 1) / 2) * ((h + 1) / 2);
+    else if (colorspace == "422") y4m_chroma = 2 * ((w + 1) / 2) * h;
+    else if (colorspace == "411") y4m_chroma = 2 * ((w + 3) / 4) * h;
+    else if (colorspace == "444") y4m_chroma = 2 * w * h;
+    else if (colorspace == "444alpha") y4m_chroma = 3 * w * h;
+    else if (colorspace == "mono") y4m_chroma = 0;
+    else throw std::runtime_error("Unsupported Y4M colorspace C" + colorspace);
+
+    if (maxval != 255) {
+        maxval = 255;
+        values.resize(256);
+        for (int v = 0; v < 256; v++) values[v] = static_cast<float>(v) / 255.f;
+    }
+    y4m = true;
+}
+
+bool FrameReader::read_y4m(Image& frame)
+{
+    int c = getc(in);
+    if (c == EOF) return false;
+    ungetc(c, in);
+    if (read_line(in).compare(0, 5, "FRAME") != 0) throw std::runtime_error("Invalid Y4M frame header");
+
+    const size_t n = static_cast<size_t>(y4m_w) * y4m_h;
+    read_bytes(in, bytes, n + y4m_chroma);
+    frame.reshape(y4m_w, y4m_h, 1);
+    float* dst = frame.data.data();
+    for (size_t i = 0; i < n; i++) dst[i] = values[bytes[i]];
+    fmt = FrameFormat::Y4M;
+    count++;
+    return true;
+}
+
+
+FrameWriter::FrameWriter(FILE* out, FrameFormat format, std::string y4m_params)
+    : out(out), fmt(format), params(y4m_params.empty() ? "F25:1 Ip A1:1" : std::move(y4m_params))
+{
+    if (format == FrameFormat::PPM) throw std::invalid_argument("Edge frames are written as PGM, PBM or Y4M");
+}
+
+void FrameWriter::write(ConstImageView frame)
+{
+    const int w = frame.w, h = frame.h;
+    const size_t row_bytes = fmt == FrameFormat::PBM ? (w + 7) / 8 : w;
+    bytes.resize(row_bytes * h);
+    std::vector<unsigned char> row(fmt == FrameFormat::PBM ? w : 0);
+    for (int y = 0; y < h; y++) {
+        const float* src = frame.RowPtr(y, 0).data();
+        unsigned char* dst = bytes.data() + row_bytes * y;
+        if (fmt != FrameFormat::PBM) {
+            interleave_float_to_u8(&src, w, 1, dst);
+            continue;
+        }
+        interleave_float_to_u8(&src, w, 1, row.data());
+        std::fill(dst, dst + row_bytes, 0);
+        for (int x = 0; x < w; x++) dst[x >> 3] |= (row[x] >> 7) << (7 - (x & 7));
+    }
+
+    bool ok = true;
+    switch (fmt) {
+        case FrameFormat::PBM: ok = fprintf(out, "P4\n%d %d\n", w, h) > 0; break;
+        case FrameFormat::Y4M:
+            if (y4m_w < 0) {
+                y4m_w = w;
+                y4m_h = h;
+                ok = fprintf(out, "YUV4MPEG2 W%d H%d %s Cmono\n", w, h, params.c_str()) > 0;
+            }
+            else if (w != y4m_w || h != y4m_h) throw std::runtime_error("Frame size changed within a Y4M stream");
+            ok = ok && fputs("FRAME\n", out) >= 0;
+            break;
+        default: ok = fprintf(out, "P5\n%d %d\n255\n", w, h) > 0; break;
+    }
+    ok = ok && fwrite(bytes.data(), 1, bytes.size(), out) == bytes.size();
+    ok = (fflush(out) == 0) && ok;
+    if (!ok) throw std::runtime_error("Cannot write edge frame");
+}
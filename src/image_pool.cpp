@@ -0,0 +1,108 @@
+#include "../include/image_pool.h"
+
+static size_t buffer_bytes(size_t floats) { return floats * sizeof(float); }
+
+Image ImagePool::acquire(int w, int h, int c)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = images.find({w, h, c});
+        if (it != images.end() && !it->second.empty()) {
+            Image im;
+            im.w = w;
+            im.h = h;
+            im.c = c;
+            im.data = std::move(it->second.back());
+            it->second.pop_back();
+            bytes -= buffer_bytes(im.data.size());
+            hits++;
+            return im;
+        }
+        misses++;
+    }
+    return Image(w, h, c);
+}
+
+PaddedImage ImagePool::acquire_padded(int w, int h, int c, int border)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = padded.find({w, h, c, border});
+        if (it != padded.end() && !it->second.empty()) {
+            PaddedImage im = std::move(it->second.back());
+            it->second.pop_back();
+            bytes -= buffer_bytes(im.data.size());
+            hits++;
+            return im;
+        }
+        misses++;
+    }
+    return PaddedImage(w, h, c, border);
+}
+
+void ImagePool::release(Image&& im)
+{
+    size_t size = buffer_bytes(im.data.size());
+    if (size == 0 || im.data.size() != static_cast<size_t>(im.w) * im.h * im.c) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (bytes + size > max_bytes) return;
+    images[{im.w, im.h, im.c}].push_back(std::move(im.data));
+    bytes += size;
+    im = Image();
+}
+
+void ImagePool::release(PaddedImage&& im)
+{
+    size_t size = buffer_bytes(im.data.size());
+    if (size == 0) return;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (bytes + size > max_bytes) return;
+    padded[{im.w, im.h, im.c, im.border}].push_back(std::move(im));
+    bytes += size;
+}
+
+ImagePoolStats ImagePool::stats(void) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    ImagePoolStats s;
+    s.hits = hits;
+    s.misses = misses;
+    s.bytes = bytes;
+    for (const auto& [key, list] : images) s.buffers += list.size();
+    for (const auto& [key, list] : padded) s.buffers += list.size();
+    return s;
+}
+
+void ImagePool::clear(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    images.clear();
+    padded.clear();
+    bytes = 0;
+}
+
+
+static ImagePool* current_pool = nullptr;
+
+void set_image_pool(ImagePool* pool) { current_pool = pool; }
+ImagePool* get_image_pool(void) { return current_pool; }
+
+Image acquire_image(int w, int h, int c)
+{
+    return current_pool ? current_pool->acquire(w, h, c) : Image(w, h, c);
+}
+
+PaddedImage acquire_padded_image(int w, int h, int c, int border)
+{
+    return current_pool ? current_pool->acquire_padded(w, h, c, border) : PaddedImage(w, h, c, border);
+}
+
+void release_image(Image&& im)
+{
+    if (current_pool) current_pool->release(std::move(im));
+}
+
+void release_image(PaddedImage&& im)
+{
+    if (current_pool) current_pool->release(std::move(im));
+}
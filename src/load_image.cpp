@@ -12,6 +12,9 @@
 
 
 #include "../include/image.h"
+#include "../include/image_t.h"
+#include "../include/interleaved_image.h"
+#include "../include/simd.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "../include/stb_image.h"
@@ -38,33 +41,48 @@ void save_image_stb(const Image& im, const string& name, int png)
   }
   */
 
-void save_image_stb(const Image& im, string name, bool is_png)
+// JPEG through stb, PNG has its own encoder (save_png.cpp)
+void save_image_stb(const Image& im, string name)
 {
     auto buffer = std::vector<unsigned char>(im.size());
 
     // copy from planar format(CHW) to interleaved (HWC)
     const size_t ch_size = static_cast<size_t>(im.h) * im.w;
-    for (auto k = 0; k < im.c; ++k) {
-        for (auto i = 0; i < ch_size; ++i) {
-            buffer[i * im.c + k] = static_cast<unsigned char>(std::roundf((255 * im.data[i + k * ch_size])));
-        }
-    }
+    std::vector<const float*> planes(im.c);
+    for (auto k = 0; k < im.c; ++k) planes[k] = im.data.data() + k * ch_size;
+    interleave_float_to_u8(planes.data(), ch_size, im.c, buffer.data());
+
+    name += ".jpg";
 
+    if (!stbi_write_jpg(name.c_str(), im.w, im.h, im.c, buffer.data(), 100))
+        throw std::ios_base::failure("Failed to write image " + name);
+}
+
+void save_image_interleaved(const InterleavedImageU8& im, string name, bool is_png)
+{
     name += (is_png?".png":".jpg");
 
     int success = 0;
     if (is_png)
-        success = stbi_write_png(name.c_str(), im.w, im.h, im.c, buffer.data(), im.w*im.c);
+        success = stbi_write_png(name.c_str(), im.w, im.h, im.c, im.data.data(), im.w*im.c);
     else
-        success = stbi_write_jpg(name.c_str(), im.w, im.h, im.c, buffer.data(), 100);
+        success = stbi_write_jpg(name.c_str(), im.w, im.h, im.c, im.data.data(), 100);
 
     if (!success)
         throw std::ios_base::failure("Failed to write image " + name);
 }
 
-void Image::save_png(string name) const { save_image_stb(*this, std::move(name), true); }
+void save_image_interleaved(const InterleavedImage& im, string name, bool is_png)
+{
+    // same rounding as save_image_stb(), in memory order
+    InterleavedImageU8 bytes(im.w, im.h, im.c);
+    const float* src = im.data.data();
+    interleave_float_to_u8(&src, im.data.size(), 1, bytes.data.data());
+    save_image_interleaved(bytes, std::move(name), is_png);
+}
+
 
-void Image::save_image(string name) const { save_image_stb(*this, std::move(name), false); }
+void Image::save_image(string name) const { save_image_stb(*this, std::move(name)); }
 
 //
 // Load an image using stb
@@ -117,14 +135,10 @@ Image load_image_stb(const string& filename, int channels)
 
   Image im(w, h, c);
 
-  for(int k = 0; k < c; ++k)
-    for(int j = 0; j < h; ++j)
-      for(int i = 0; i < w; ++i)
-        {
-        int dst_index = i + w*j + w*h*k;
-        int src_index = k + c*i + c*w*j;
-        im.data[dst_index] = static_cast<float>(data[src_index])/255.f;
-        }
+  // from interleaved (HWC) to planar (CHW)
+  std::vector<float*> planes(c);
+  for(int k = 0; k < c; ++k) planes[k] = im.RowPtr(0, k).data();
+  deinterleave_u8_to_float(data.get(), w*h, c, planes.data());
   //We don't like alpha channels, #YOLO
   if(im.c == 4) im.c = 3;
   return im;
@@ -132,6 +146,115 @@ Image load_image_stb(const string& filename, int channels)
 
 void Image::load_image(const string& filename) { *this=load_image_stb(filename,0); }
 
+// Decodes an image straight into one gray plane of Gray (Image or ImageU8),
+// with the values of rgb_to_grayscale(load_image()) for 3 or 4 channels and
+// of the first channel otherwise. Each luma term is the double product of
+// rgb_to_grayscale() on v/255.f; there are 256 of each, so they come from
+// tables and are summed in the same order. Integer pixels are then converted
+// as by convert_image().
+template<typename Gray>
+static Gray load_gray_stb(const string& filename)
+  {
+  int w, h, c;
+
+  auto stbi_deleter = [](unsigned char* ptr) {
+    stbi_image_free(ptr);
+    };
+
+  std::unique_ptr<unsigned char[], decltype(stbi_deleter)>data(stbi_load(filename.c_str(), &w, &h, &c, 0), stbi_deleter);
+
+  if (!data)
+    throw std::ios_base::failure("Cannot load image " + filename + "\nSTB reason: " + stbi_failure_reason());
+
+  using T = typename decltype(Gray::data)::value_type;
+  Gray im(w, h, 1);
+  const unsigned char* src = data.get();
+  T* dst = im.data.data();
+  const size_t n = static_cast<size_t>(w) * h;
+  if (c < 3)
+    {
+    for (size_t i = 0; i < n; ++i) dst[i] = convert_pixel<T>(static_cast<float>(src[i * c]) / 255.f);
+    return im;
+    }
+
+  double luma[3][256];
+  const double weights[3] = {0.299, 0.587, 0.114};
+  for (int k = 0; k < 3; ++k)
+    for (int v = 0; v < 256; ++v) luma[k][v] = weights[k] * (static_cast<float>(v) / 255.f);
+  for (size_t i = 0; i < n; ++i)
+    {
+    const unsigned char* p = src + i * c;
+    float v = luma[0][p[0]] + luma[1][p[1]] + luma[2][p[2]];
+    dst[i] = convert_pixel<T>(v);
+    }
+  return im;
+  }
+
+Image load_image_gray(const string& filename) { return load_gray_stb<Image>(filename); }
+ImageU8 load_image_gray_u8(const string& filename) { return load_gray_stb<ImageU8>(filename); }
+
+InterleavedImageU8 load_image_interleaved_u8(const string& filename)
+  {
+  int w, h, c;
+
+  auto stbi_deleter = [](unsigned char* ptr) {
+    stbi_image_free(ptr);
+    };
+
+  std::unique_ptr<unsigned char[], decltype(stbi_deleter)>data(stbi_load(filename.c_str(), &w, &h, &c, 0), stbi_deleter);
+
+  if (!data)
+    throw std::ios_base::failure("Cannot load image " + filename + "\nSTB reason: " + stbi_failure_reason());
+
+  // no alpha channel, as in load_image_stb()
+  int channels = c == 4 ? 3 : c;
+  InterleavedImageU8 im(w, h, channels);
+  const unsigned char* src = data.get();
+  if (channels == c)
+    std::copy(src, src + im.data.size(), im.data.begin());
+  else
+    for (size_t i = 0, n = static_cast<size_t>(w) * h; i < n; ++i)
+      std::copy(src + i * c, src + i * c + channels, im.data.begin() + i * channels);
+  return im;
+  }
+
+InterleavedImage load_image_interleaved(const string& filename)
+  {
+  // same values as convert_image<float>(), in memory order
+  InterleavedImageU8 bytes = load_image_interleaved_u8(filename);
+  InterleavedImage im(bytes.w, bytes.h, bytes.c);
+  float* dst = im.data.data();
+  deinterleave_u8_to_float(bytes.data.data(), bytes.data.size(), 1, &dst);
+  return im;
+  }
+
+ImageU8 load_image_u8(const string& filename)
+  {
+  int w, h, c;
+
+  auto stbi_deleter = [](unsigned char* ptr) {
+    stbi_image_free(ptr);
+    };
+
+  std::unique_ptr<unsigned char[], decltype(stbi_deleter)>data(stbi_load(filename.c_str(), &w, &h, &c, 0), stbi_deleter);
+
+  if (!data)
+    throw std::ios_base::failure("Cannot load image " + filename + "\nSTB reason: " + stbi_failure_reason());
+
+  // no alpha channel, as in load_image_stb()
+  int channels = c == 4 ? 3 : c;
+  ImageU8 im(w, h, channels);
+
+  for(int k = 0; k < channels; ++k)
+    for(int j = 0; j < h; ++j)
+      {
+      const unsigned char* src = data.get() + static_cast<size_t>(w) * c * j + k;
+      uint8_t* dst = im.RowPtr(j, k).data();
+      for(int i = 0; i < w; ++i) dst[i] = src[i * c];
+      }
+  return im;
+  }
+
 
 void Image::save_binary(const string& filename) const
   {
@@ -0,0 +1,199 @@
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../include/mapped_image.h"
+
+// Fletcher-64 over 32-bit little-endian words. The sums are reduced every
+// BLOCK words, before sum2 can overflow.
+struct Fletcher64
+  {
+  static constexpr uint64_t MOD = 0xffffffffu;
+  static constexpr size_t BLOCK = 1 << 15;
+  uint64_t sum1 = 0, sum2 = 0;
+
+  // A tail of less than 4 bytes is added as one zero-padded word, so only
+  // the last call may have n not a multiple of 4
+  void add(const unsigned char* p, size_t n)
+    {
+    size_t tail = n % 4;
+    n /= 4;
+    while (n)
+      {
+      size_t m = std::min(n, BLOCK);
+      uint64_t s1 = sum1, s2 = sum2;
+      for (size_t i = 0; i < m; i++)
+        {
+        uint32_t word;
+        memcpy(&word, p + 4 * i, 4);
+        s1 += word;
+        s2 += s1;
+        }
+      sum1 = s1 % MOD;
+      sum2 = s2 % MOD;
+      p += 4 * m;
+      n -= m;
+      }
+    if (tail)
+      {
+      uint32_t word = 0;
+      memcpy(&word, p, tail);
+      sum1 = (sum1 + word) % MOD;
+      sum2 = (sum2 + sum1) % MOD;
+      }
+    }
+
+  uint64_t value(void) const { return (sum2 << 32) | sum1; }
+  };
+
+static size_t padded_stride(int w, size_t pixel_size)
+  {
+  size_t per_row = MappedImageHeader::ALIGNMENT / pixel_size;
+  return (static_cast<size_t>(w) + per_row - 1) / per_row * per_row;
+  }
+
+static size_t pixel_size(PixelType type)
+  {
+  switch (type)
+    {
+    case PixelType::F32: return 4;
+    case PixelType::U8:  return 1;
+    case PixelType::U16: return 2;
+    case PixelType::S16: return 2;
+    }
+  return 0;
+  }
+
+template<typename T>
+void save_mapped_image(BasicImageView<const T> im, const std::string& filename)
+  {
+  MappedImageHeader hd = {};
+  memcpy(hd.magic, MappedImageHeader::MAGIC, sizeof(hd.magic));
+  hd.version = MappedImageHeader::VERSION;
+  hd.type = pixel_type_of<T>();
+  hd.w = im.w; hd.h = im.h; hd.c = im.c;
+  hd.stride = padded_stride(im.w, sizeof(T));
+  hd.plane = hd.stride * im.h;
+  hd.data_offset = sizeof(MappedImageHeader);
+  hd.data_bytes = hd.plane * im.c * sizeof(T);
+
+  // rows padded with zeros, the checksum is known once all are written
+  std::vector<unsigned char> row(hd.stride * sizeof(T));
+  Fletcher64 sum;
+  std::string tmp = filename + ".tmp";
+  FILE* fn = fopen(tmp.c_str(), "wb");
+  if (!fn) throw std::runtime_error("Cannot open file: " + tmp);
+  bool ok = fwrite(&hd, sizeof(hd), 1, fn) == 1;
+  for (int k = 0; k < im.c && ok; k++)
+    for (int y = 0; y < im.h && ok; y++)
+      {
+      memcpy(row.data(), im.RowPtr(y, k).data(), static_cast<size_t>(im.w) * sizeof(T));
+      sum.add(row.data(), row.size());
+      ok = fwrite(row.data(), 1, row.size(), fn) == row.size();
+      }
+  hd.checksum = sum.value();
+  ok = ok && fseek(fn, 0, SEEK_SET) == 0 && fwrite(&hd, sizeof(hd), 1, fn) == 1;
+  ok = (fclose(fn) == 0) && ok;
+  if (!ok || rename(tmp.c_str(), filename.c_str()) != 0)
+    {
+    remove(tmp.c_str());
+    throw std::runtime_error("Cannot write mapped image: " + filename);
+    }
+  }
+
+template void save_mapped_image<float>   (BasicImageView<const float>    im, const std::string& filename);
+template void save_mapped_image<uint8_t> (BasicImageView<const uint8_t>  im, const std::string& filename);
+template void save_mapped_image<uint16_t>(BasicImageView<const uint16_t> im, const std::string& filename);
+template void save_mapped_image<int16_t> (BasicImageView<const int16_t>  im, const std::string& filename);
+
+
+MappedImage::MappedImage(const std::string& filename, bool verify_checksum)
+  {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) throw std::runtime_error("Cannot open file: " + filename);
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(MappedImageHeader))
+    {
+    close(fd);
+    throw std::runtime_error("Not a mapped image: " + filename);
+    }
+  length = st.st_size;
+  void* addr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) throw std::runtime_error("Cannot map file: " + filename);
+  base = static_cast<const unsigned char*>(addr);
+
+  const MappedImageHeader* hd = reinterpret_cast<const MappedImageHeader*>(base);
+  // no product below can wrap: each is first bounded by a division, and
+  // every pixel of view() then lies within data_bytes, within the file.
+  // An aligned stride and plane make data_bytes a multiple of ALIGNMENT
+  const uint64_t size = pixel_size(hd->type);
+  bool valid = memcmp(hd->magic, MappedImageHeader::MAGIC, sizeof(hd->magic)) == 0
+            && hd->version == MappedImageHeader::VERSION
+            && size != 0
+            && hd->w >= 0 && hd->h >= 0 && hd->c >= 0
+            && hd->data_offset % MappedImageHeader::ALIGNMENT == 0
+            && hd->data_offset >= sizeof(MappedImageHeader)
+            && hd->data_offset <= length
+            && hd->data_bytes <= length - hd->data_offset
+            && hd->stride >= static_cast<uint64_t>(hd->w)
+            && hd->stride % (MappedImageHeader::ALIGNMENT / size) == 0
+            && hd->plane % (MappedImageHeader::ALIGNMENT / size) == 0
+            && (hd->h == 0 || hd->stride <= hd->plane / static_cast<uint64_t>(hd->h))
+            && (hd->c == 0 ? hd->data_bytes == 0
+                           : hd->plane <= hd->data_bytes / (static_cast<uint64_t>(hd->c) * size)
+                             && hd->plane * hd->c * size == hd->data_bytes);
+  if (!valid)
+    {
+    unmap();
+    throw std::runtime_error("Invalid mapped image header: " + filename);
+    }
+  header = hd;
+  if (verify_checksum && !verify())
+    {
+    unmap();
+    throw std::runtime_error("Checksum mismatch in mapped image: " + filename);
+    }
+  }
+
+MappedImage::MappedImage(MappedImage&& other) noexcept
+  : base(other.base), length(other.length), header(other.header)
+  {
+  other.base = nullptr;
+  other.length = 0;
+  other.header = nullptr;
+  }
+
+MappedImage& MappedImage::operator=(MappedImage&& other) noexcept
+  {
+  if (this != &other)
+    {
+    unmap();
+    std::swap(base, other.base);
+    std::swap(length, other.length);
+    std::swap(header, other.header);
+    }
+  return *this;
+  }
+
+MappedImage::~MappedImage() { unmap(); }
+
+void MappedImage::unmap(void)
+  {
+  if (base) munmap(const_cast<unsigned char*>(base), length);
+  base = nullptr;
+  length = 0;
+  header = nullptr;
+  }
+
+bool MappedImage::verify(void) const
+  {
+  const MappedImageHeader& hd = info();
+  Fletcher64 sum;
+  sum.add(base + hd.data_offset, hd.data_bytes);
+  return sum.value() == hd.checksum;
+  }
@@ -0,0 +1,77 @@
+#include <algorithm>
+
+#include "../include/image.h"
+#include "../include/padded_image.h"
+
+static int round_up(int v, int m) { return (v + m - 1) / m * m; }
+
+PaddedImage::PaddedImage(int w, int h, int c, int border)
+    : w(w), h(h), c(c), border(border)
+{
+    assert(w >= 0 && h >= 0 && c >= 0 && border >= 0);
+    left = round_up(border, ALIGN_FLOATS);
+    stride = round_up(left + w + border, ALIGN_FLOATS);
+    plane = static_cast<size_t>(stride) * (h + 2 * border);
+    data.resize(plane * c);
+}
+
+PaddedImage::PaddedImage(ConstImageView im, int border, BorderMode mode)
+    : PaddedImage(im.w, im.h, im.c, border)
+{
+    assign(im, mode);
+}
+
+void PaddedImage::assign(ConstImageView im, BorderMode mode)
+{
+    assert(im.w == w && im.h == h && im.c == c);
+    for (int k = 0; k < c; ++k)
+        for (int y = 0; y < h; ++y) {
+            std::span<const float> src = im.RowPtr(y, k);
+            std::copy(src.begin(), src.end(), RowPtr(y, k).begin());
+        }
+    fill_border(mode);
+}
+
+// index of the interior pixel that mirrors/replicates i, for a line of n pixels
+static int border_index(int i, int n, BorderMode mode)
+{
+    if (mode == BorderMode::Replicate || n == 1) return std::clamp(i, 0, n - 1);
+    // reflection around the first and last pixel, periodic with period 2(n-1)
+    int period = 2 * (n - 1);
+    i %= period;
+    if (i < 0) i += period;
+    return i < n ? i : period - i;
+}
+
+void PaddedImage::fill_border(BorderMode mode)
+{
+    if (w == 0 || h == 0 || border == 0) return;
+    for (int k = 0; k < c; ++k) {
+        // left and right halo of the interior rows
+        for (int y = 0; y < h; ++y) {
+            float* row = RowPtr(y, k).data();
+            for (int x = 1; x <= border; ++x) {
+                row[-x] = row[border_index(-x, w, mode)];
+                row[w - 1 + x] = row[border_index(w - 1 + x, w, mode)];
+            }
+        }
+        // whole rows above and below, halo columns included
+        for (int y = 1; y <= border; ++y) {
+            const float* top = RowPtr(border_index(-y, h, mode), k).data() - border;
+            const float* bottom = RowPtr(border_index(h - 1 + y, h, mode), k).data() - border;
+            std::copy(top, top + w + 2 * border, RowPtr(-y, k).data() - border);
+            std::copy(bottom, bottom + w + 2 * border, RowPtr(h - 1 + y, k).data() - border);
+        }
+    }
+}
+
+Image PaddedImage::to_image(void) const
+{
+    Image im(w, h, c);
+    for (int k = 0; k < c; ++k)
+        for (int y = 0; y < h; ++y) {
+            std::span<const float> src = RowPtr(y, k);
+            std::copy(src.begin(), src.end(), im.RowPtr(y, k).begin());
+        }
+    return im;
+}
@@ -0,0 +1,64 @@
+#include "../include/parallel.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <Eigen/ThreadPool>
+
+static std::mutex pool_mutex;
+static std::unique_ptr<Eigen::ThreadPool> pool;
+static int num_threads = 0;
+
+static int resolve_threads(int n) { return n > 0 ? n : std::max(1u, std::thread::hardware_concurrency()); }
+
+void set_num_threads(int n)
+{
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (resolve_threads(n) != resolve_threads(num_threads)) pool.reset();
+    num_threads = n;
+}
+
+int get_num_threads(void)
+{
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    return resolve_threads(num_threads);
+}
+
+// the pool, created on first use; nullptr when running on a single thread
+static Eigen::ThreadPool* get_pool(void)
+{
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    int n = resolve_threads(num_threads);
+    if (n == 1) return nullptr;
+    if (!pool) pool = std::make_unique<Eigen::ThreadPool>(n);
+    return pool.get();
+}
+
+void parallel_for(int n, const std::function<void(int, int)>& fn, int grain)
+{
+    if (n <= 0) return;
+    grain = std::max(grain, 1);
+    Eigen::ThreadPool* tp = n > grain ? get_pool() : nullptr;
+    // nested calls from a pool thread run inline, the pool would deadlock waiting on itself
+    if (!tp || tp->CurrentThreadId() != -1) {
+        fn(0, n);
+        return;
+    }
+    Eigen::ForkJoinScheduler::ParallelFor(0, n, grain, [&fn](Eigen::Index begin, Eigen::Index end) { fn(begin, end); }, tp);
+}
+
+void parallel_for_tiles(int w, int h, const std::function<void(const Tile&)>& fn, int tile_w, int tile_h)
+{
+    if (w <= 0 || h <= 0) return;
+    int nx = (w + tile_w - 1) / tile_w;
+    int ny = (h + tile_h - 1) / tile_h;
+    parallel_for(nx * ny, [&](int begin, int end) {
+        for (int t = begin; t < end; ++t) {
+            int tx = t % nx, ty = t / nx;
+            Tile tile{tx * tile_w, ty * tile_h, std::min(w, (tx + 1) * tile_w), std::min(h, (ty + 1) * tile_h)};
+            fn(tile);
+        }
+    });
+}
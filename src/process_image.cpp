@@ -4,6 +4,7 @@
 #include <cmath>
 
 #include "../include/image.h"
+#include "../include/interleaved_image.h"
 
 using namespace std;
 
@@ -50,13 +51,9 @@ Image grayscale_to_rgb(const Image &im, float r, float g, float b) {
 void shift_image(Image &im, int c, float v) {
     assert(c >= 0 && c < im.c); // needs to be a valid channel
 
-    // TODO: shift all the pixels at the specified channel
-    int ch_size = im.w*im.h;
-    for (int i = 0; i < im.w; ++i) {
-        for (int j = 0; j < im.h; ++j) {
-            im(i,j,c) += v;
-        }
-    }
+    // shift all the pixels at the specified channel, in one pass over the plane
+    ImageView plane = im.view().channel(c);
+    assign(plane, expr(plane) + v);
 
 
 }
@@ -68,13 +65,9 @@ void shift_image(Image &im, int c, float v) {
 void scale_image(Image &im, int c, float v) {
     assert(c >= 0 && c < im.c); // needs to be a valid channel
 
-    // TODO: scale all the pixels at the specified channel
-    int ch_size = im.w*im.h;
-    for (int i = 0; i < im.w; ++i) {
-        for (int j = 0; j < im.h; ++j) {
-            im(i,j,c) *= v;
-        }
-    }
+    // scale all the pixels at the specified channel
+    ImageView plane = im.view().channel(c);
+    assign(plane, expr(plane) * v);
 
 }
 
@@ -82,21 +75,17 @@ void scale_image(Image &im, int c, float v) {
 // HW0 #5
 // Image& im: input image to be modified in-place
 void clamp_image(Image &im) {
-    // TODO: clamp all the pixels in all channel to be between 0 and 1
-    for (int k = 0; k < im.c; ++k) {
-        for (int i = 0; i < im.w; ++i) {
-            for (int j = 0; j < im.h; ++j) {
-                if (im(i,j,k) > 1) {
-                    im(i,j,k)=1;
-                }
-                if (im(i,j,k)<0){
-                    im(i,j,k)=0;
-                }
-            }
-        }
-    }
+    // clamp all the pixels in all channel to be between 0 and 1
+    im = clamp(im);
+
 
+}
 
+// Image&& im: input image, clamped in place
+// returns im
+Image clamp_image(Image &&im) {
+    clamp_image(im);
+    return std::move(im);
 }
 
 // These might be handy
@@ -109,59 +98,112 @@ float min(float a, float b, float c) {
 }
 
 
-// HW0 #6
-// Image& im: input image to be modified in-place
-void rgb_to_hsv(Image &im) {
-    assert(im.c == 3 && "only works for 3-channels images");
-
-    // TODO: Convert all pixels from RGB format to HSV format
+// Converts one pixel from RGB to HSV in place
+static void rgb_to_hsv_pixel(float RGB[3]) {
     float V, S, H;
     float m, C;
-    float RGB[3];
     float &R = RGB[0];
     float &G = RGB[1];
     float &B = RGB[2];
     int value_idx;
+    // Value
+    value_idx = max_element(RGB, RGB+3) - RGB;
+    V = RGB[value_idx];
+    // Saturation
+    m = *min_element(RGB, RGB+3);
+    C = V - m;
+    if (V==0){
+        S = 0;
+    }
+    else {
+        S = C / V;
+    }
+    // Hue
+    if (C == 0) {
+        H = 0;
+    }
+    else {
+        switch (value_idx) {
+            case 0:
+                H = (G-B)/C;
+                break;
+            case 1:
+                H = (B-R)/C+2;
+                break;
+            case 2:
+                H = (R-G)/C+4;
+                break;
+        }
+    }
+    H = H/6;
+    if (H<0) H++;
+    // write the new color space values
+    RGB[0]=H;
+    RGB[1]=S;
+    RGB[2]=V;
+}
+
+// Converts one pixel from HSV to RGB in place
+static void hsv_to_rgb_pixel(float HSV[3]) {
+    float H, S, V;
+    float C, X, m;
+    float R, G, B;
+    H = HSV[0];
+    S = HSV[1];
+    V = HSV[2];
+    C = V * S;
+    X = C * (1-abs(fmod(6*H, 2) - 1));
+    m = V - C;
+    if (H<1.0/6) {
+        R = C;
+        G = X;
+        B = 0;
+    }
+    else if(H<2.0/6) {
+        R = X;
+        G = C;
+        B = 0;
+    }
+    else if (H<3.0/6) {
+        R = 0;
+        G = C;
+        B = X;
+    }
+    else if (H<4.0/6) {
+        R = 0;
+        G = X;
+        B = C;
+    }
+    else if (H<5.0/6) {
+        R = X;
+        G = 0;
+        B = C;
+    }
+    else {
+        R = C;
+        G = 0;
+        B = X;
+    }
+    R+=m;
+    G+=m;
+    B+=m;
+    // update values
+    HSV[0] = R;
+    HSV[1] = G;
+    HSV[2] = B;
+}
+
+// HW0 #6
+// Image& im: input image to be modified in-place
+void rgb_to_hsv(Image &im) {
+    assert(im.c == 3 && "only works for 3-channels images");
+
+    float pixel[3];
     for (int i = 0; i < im.w; ++i) {
         for (int j = 0; j < im.h; ++j) {
-            RGB[0] = im(i,j,0);
-            RGB[1] = im(i,j,1);
-            RGB[2] = im(i,j,2);
-            // Value
-            value_idx = max_element(RGB, RGB+3) - RGB;
-            V = RGB[value_idx];
-            // Saturation
-            m = *min_element(RGB, RGB+3);
-            C = V - m;
-            if (V==0){
-                S = 0;
-            }
-            else {
-                S = C / V;
-            }
-            // Hue
-            if (C == 0) {
-                H = 0;
-            }
-            else {
-                switch (value_idx) {
-                    case 0:
-                        H = (G-B)/C;
-                        break;
-                    case 1:
-                        H = (B-R)/C+2;
-                        break;
-                    case 2:
-                        H = (R-G)/C+4;
-                        break;
-                }
-            }
-            H = H/6;
-            if (H<0) H++;
-            // write the new color space values to im
-            im(i,j,0)=H;
-            im(i,j,1)=S;
-            im(i,j,2)=V;
+            for (int k = 0; k < 3; ++k) pixel[k] = im(i,j,k);
+            rgb_to_hsv_pixel(pixel);
+            for (int k = 0; k < 3; ++k) im(i,j,k) = pixel[k];
         }
     }
 
@@ -172,59 +214,27 @@ void rgb_to_hsv(Image &im) {
 void hsv_to_rgb(Image &im) {
     assert(im.c == 3 && "only works for 3-channels images");
 
-    // TODO: Convert all pixels from HSV format to RGB format
-    float H, S, V;
-    float C, X, m;
-    float R, G, B;
+    float pixel[3];
     for (int i = 0; i < im.w; ++i) {
         for (int j = 0; j < im.h; ++j) {
-            H = im(i,j,0);
-            S = im(i,j,1);
-            V = im(i,j,2);
-            C = V * S;
-            X = C * (1-abs(fmod(6*H, 2) - 1));
-            m = V - C;
-            if (H<1.0/6) {
-                R = C;
-                G = X;
-                B = 0;
-            }
-            else if(H<2.0/6) {
-                R = X;
-                G = C;
-                B = 0;
-            }
-            else if (H<3.0/6) {
-                R = 0;
-                G = C;
-                B = X;
-            }
-            else if (H<4.0/6) {
-                R = 0;
-                G = X;
-                B = C;
-            }
-            else if (H<5.0/6) {
-                R = X;
-                G = 0;
-                B = C;
-            }
-            else {
-                R = C;
-                G = 0;
-                B = X;
-            }
-            R+=m;
-            G+=m;
-            B+=m;
-            // update image values
-            im(i,j,0) = R;
-            im(i,j,1) = G;
-            im(i,j,2) = B;
+            for (int k = 0; k < 3; ++k) pixel[k] = im(i,j,k);
+            hsv_to_rgb_pixel(pixel);
+            for (int k = 0; k < 3; ++k) im(i,j,k) = pixel[k];
         }
     }
 
+}
+
+// Interleaved versions: each pixel is already three contiguous floats
+// InterleavedImage& im: input image to be modified in-place
+void rgb_to_hsv(InterleavedImage &im) {
+    assert(im.c == 3 && "only works for 3-channels images");
+    for (size_t i = 0; i < im.data.size(); i += 3) rgb_to_hsv_pixel(&im.data[i]);
+}
 
+void hsv_to_rgb(InterleavedImage &im) {
+    assert(im.c == 3 && "only works for 3-channels images");
+    for (size_t i = 0; i < im.data.size(); i += 3) hsv_to_rgb_pixel(&im.data[i]);
 }
 
 
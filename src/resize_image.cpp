@@ -53,6 +53,14 @@ float Image::pixel_bilinear(float x, float y, int c) const
 Image nearest_resize(const Image& im, int w, int h)
   {
   Image ret(w,h,im.c);
+  nearest_resize_into(im, w, h, ret);
+  return ret;
+  }
+
+// Same as nearest_resize(), into ret
+void nearest_resize_into(const Image& im, int w, int h, Image& ret)
+  {
+  ret.reshape(w,h,im.c);
   
   for (int i = 0; i < w; ++i) {
     for (int j = 0; j < h; ++j) {
@@ -68,8 +76,6 @@ Image nearest_resize(const Image& im, int w, int h)
 
     }
   }
-
-  return ret;
   }
 
 
@@ -79,8 +85,15 @@ Image nearest_resize(const Image& im, int w, int h)
 // return new Image of size (w,h,im.c)
 Image bilinear_resize(const Image& im, int w, int h)
   {
-  
   Image ret(w, h, im.c);
+  bilinear_resize_into(im, w, h, ret);
+  return ret;
+  }
+
+// Same as bilinear_resize(), into ret
+void bilinear_resize_into(const Image& im, int w, int h, Image& ret)
+  {
+  ret.reshape(w, h, im.c);
 
   for (int i = 0; i < w; ++i) {
     for (int j = 0; j < h; ++j) {
@@ -94,9 +107,6 @@ Image bilinear_resize(const Image& im, int w, int h)
 
     }
   }
-
-
-  return ret;
   }
 
 
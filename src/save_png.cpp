@@ -0,0 +1,210 @@
+#include <cstdio>
+#include <cstdlib>
+#include <ios>
+
+#include <zlib.h>
+
+#include "../include/image.h"
+#include "../include/parallel.h"
+#include "../include/simd.h"
+
+// Bytes of pixels deflated together when PngOptions::rows_per_band is 0
+static const size_t PNG_BAND_BYTES = 256 << 10;
+// Deflate window: each band is primed with that much of the previous one
+static const size_t DEFLATE_WINDOW = 32 << 10;
+// Largest IDAT chunk written, the zlib stream is split over as many as needed
+static const size_t IDAT_BYTES = 8 << 20;
+
+static void put_u32(vector<unsigned char>& out, uint32_t v)
+{
+    unsigned char b[4] = {static_cast<unsigned char>(v >> 24), static_cast<unsigned char>(v >> 16),
+                          static_cast<unsigned char>(v >> 8), static_cast<unsigned char>(v)};
+    out.insert(out.end(), b, b + 4);
+}
+
+static void put_chunk(vector<unsigned char>& out, const char* type, const unsigned char* data, size_t n)
+{
+    put_u32(out, n);
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + n);
+    put_u32(out, crc32(0, out.data() + start, n + 4));
+}
+
+static inline unsigned char paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+// Filters a scanline of n bytes, bpp bytes per pixel, with the given filter
+// type (1 to 4; 0 is a copy). prev is the unfiltered previous scanline, or
+// zeros for the first one.
+static void filter_row(const unsigned char* cur, const unsigned char* prev, size_t n, int bpp, int type, unsigned char* out)
+{
+    for (size_t i = 0; i < n; i++) {
+        int a = i >= static_cast<size_t>(bpp) ? cur[i - bpp] : 0;
+        int b = prev[i];
+        int c = i >= static_cast<size_t>(bpp) ? prev[i - bpp] : 0;
+        int pred = 0;
+        switch (type) {
+            case 1: pred = a; break;
+            case 2: pred = b; break;
+            case 3: pred = (a + b) / 2; break;
+            case 4: pred = paeth(a, b, c); break;
+        }
+        out[i] = static_cast<unsigned char>(cur[i] - pred);
+    }
+}
+
+// Scanline with its filter type byte in front. Adaptive keeps the filter whose
+// output, read as signed bytes, has the smallest sum of absolute values.
+static void encode_row(const unsigned char* cur, const unsigned char* prev, size_t n, int bpp, PngFilter filter,
+                       unsigned char* out, vector<unsigned char>& tmp)
+{
+    if (filter != PngFilter::Adaptive) {
+        out[0] = static_cast<unsigned char>(filter);
+        filter_row(cur, prev, n, bpp, out[0], out + 1);
+        return;
+    }
+    uint64_t best = UINT64_MAX;
+    tmp.resize(n);
+    for (int type = 0; type <= 4; type++) {
+        filter_row(cur, prev, n, bpp, type, tmp.data());
+        uint64_t cost = 0;
+        for (size_t i = 0; i < n; i++) cost += abs(static_cast<signed char>(tmp[i]));
+        if (cost < best) {
+            best = cost;
+            out[0] = type;
+            std::copy(tmp.begin(), tmp.end(), out + 1);
+        }
+    }
+}
+
+// Raw deflate of one band. The band is primed with the dictionary and ends
+// with a sync flush (an empty stored block), or is the final block.
+static vector<unsigned char> deflate_band(const unsigned char* data, size_t n, const unsigned char* dict, size_t dict_n,
+                                          int level, bool last)
+{
+    z_stream z = {};
+    if (deflateInit2(&z, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw std::runtime_error("deflateInit2 failed");
+    if (dict_n) deflateSetDictionary(&z, dict, dict_n);
+
+    // deflateBound() does not count the sync flush marker
+    vector<unsigned char> out(deflateBound(&z, n) + 16);
+    z.next_in = const_cast<unsigned char*>(data);
+    z.avail_in = n;
+    int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+    int ret;
+    do {
+        if (z.total_out == out.size()) out.resize(out.size() * 2);
+        z.next_out = out.data() + z.total_out;
+        z.avail_out = out.size() - z.total_out;
+        ret = deflate(&z, flush);
+    } while (z.avail_out == 0 || (last && ret != Z_STREAM_END));
+    out.resize(z.total_out);
+    deflateEnd(&z);
+    return out;
+}
+
+vector<unsigned char> encode_png(const Image& im, const PngOptions& options)
+{
+    if (im.w <= 0 || im.h <= 0) throw std::ios_base::failure("Cannot encode an empty image as PNG");
+    assert(options.compression >= 0 && options.compression <= 9);
+    const bool gray = options.format != PngFormat::Auto;
+    const int channels = gray ? 1 : im.c;
+    const int depth = options.format == PngFormat::Gray1 ? 1 : 8;
+    if (channels < 1 || channels > 4) throw std::ios_base::failure("Cannot encode a PNG with " + std::to_string(channels) + " channels");
+    const int bpp = depth == 1 ? 1 : channels;
+    const size_t row_bytes = depth == 1 ? (im.w + 7) / 8 : static_cast<size_t>(im.w) * channels;
+    const size_t line = row_bytes + 1;
+    PngFilter filter = options.filter == PngFilter::Adaptive && depth < 8 ? PngFilter::None : options.filter;
+
+    // 8-bit interleaved scanlines, rounded as by save_image(), bits packed MSB first for Gray1
+    vector<unsigned char> raw(row_bytes * im.h);
+    parallel_for(im.h, [&](int y0, int y1) {
+        vector<unsigned char> bytes(depth == 1 ? im.w : 0);
+        const float* planes[4];
+        for (int y = y0; y < y1; y++) {
+            for (int k = 0; k < channels; k++) planes[k] = im.RowPtr(y, k).data();
+            unsigned char* dst = raw.data() + row_bytes * y;
+            if (depth == 8) {
+                interleave_float_to_u8(planes, im.w, channels, dst);
+                continue;
+            }
+            interleave_float_to_u8(planes, im.w, 1, bytes.data());
+            std::fill(dst, dst + row_bytes, 0);
+            for (int x = 0; x < im.w; x++) dst[x >> 3] |= (bytes[x] >> 7) << (7 - (x & 7));
+        }
+    }, TILE_H);
+
+    vector<unsigned char> filtered(line * im.h);
+    const vector<unsigned char> zeros(row_bytes);
+    parallel_for(im.h, [&](int y0, int y1) {
+        vector<unsigned char> tmp;
+        for (int y = y0; y < y1; y++) {
+            const unsigned char* prev = y ? raw.data() + row_bytes * (y - 1) : zeros.data();
+            encode_row(raw.data() + row_bytes * y, prev, row_bytes, bpp, filter, filtered.data() + line * y, tmp);
+        }
+    }, TILE_H);
+
+    // bands of whole scanlines, deflated in parallel
+    int band_rows = options.rows_per_band > 0 ? options.rows_per_band : std::max<int>(1, PNG_BAND_BYTES / line);
+    int bands = (im.h + band_rows - 1) / band_rows;
+    vector<vector<unsigned char>> parts(bands);
+    vector<uLong> adlers(bands);
+    parallel_for(bands, [&](int b0, int b1) {
+        for (int b = b0; b < b1; b++) {
+            size_t start = line * b * static_cast<size_t>(band_rows);
+            size_t end = std::min(filtered.size(), start + line * band_rows);
+            size_t dict = std::min(start, DEFLATE_WINDOW);
+            parts[b] = deflate_band(filtered.data() + start, end - start, filtered.data() + start - dict, dict,
+                                    options.compression, b == bands - 1);
+            adlers[b] = adler32(adler32(0, nullptr, 0), filtered.data() + start, end - start);
+        }
+    });
+
+    // zlib stream: header, the bands, Adler-32 of the whole scanline data
+    int level = options.compression;
+    int flevel = level < 2 ? 0 : (level < 6 ? 1 : (level == 6 ? 2 : 3));
+    unsigned char cmf = 0x78, flg = flevel << 6;
+    flg += (31 - (cmf * 256 + flg) % 31) % 31;
+    vector<unsigned char> idat = {cmf, flg};
+    uLong adler = adlers[0];
+    for (int b = 0; b < bands; b++) {
+        idat.insert(idat.end(), parts[b].begin(), parts[b].end());
+        if (b) {
+            size_t start = line * b * static_cast<size_t>(band_rows);
+            adler = adler32_combine(adler, adlers[b], std::min(filtered.size(), start + line * band_rows) - start);
+        }
+    }
+    put_u32(idat, adler);
+
+    static const unsigned char signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+    static const unsigned char color_types[5] = {0, 0, 4, 2, 6};
+    vector<unsigned char> png(signature, signature + 8);
+    vector<unsigned char> ihdr;
+    put_u32(ihdr, im.w);
+    put_u32(ihdr, im.h);
+    ihdr.insert(ihdr.end(), {static_cast<unsigned char>(depth), color_types[channels], 0, 0, 0});
+    put_chunk(png, "IHDR", ihdr.data(), ihdr.size());
+    for (size_t i = 0; i < idat.size(); i += IDAT_BYTES)
+        put_chunk(png, "IDAT", idat.data() + i, std::min(IDAT_BYTES, idat.size() - i));
+    put_chunk(png, "IEND", nullptr, 0);
+    return png;
+}
+
+void Image::save_png(string name, const PngOptions& options) const
+{
+    vector<unsigned char> png = encode_png(*this, options);
+    name += ".png";
+    FILE* fn = fopen(name.c_str(), "wb");
+    bool ok = fn && fwrite(png.data(), 1, png.size(), fn) == png.size();
+    if (fn) ok = (fclose(fn) == 0) && ok;
+    if (!ok) throw std::ios_base::failure("Failed to write image " + name);
+}
+
+void Image::save_png(string name) const { save_png(std::move(name), PngOptions()); }
@@ -0,0 +1,163 @@
+#include <atomic>
+#include <cmath>
+
+#include "../include/simd.h"
+
+static SimdLevel detect_simd_level(void)
+{
+#ifdef SRIMG_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SimdLevel::AVX512;
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+#endif
+    return SimdLevel::Scalar;
+}
+
+// read by the kernels on the pool threads, possibly while it is set
+static std::atomic<SimdLevel> max_level{SimdLevel::AVX512};
+
+SimdLevel simd_level(void)
+{
+    static const SimdLevel detected = detect_simd_level();
+    SimdLevel level = max_level.load(std::memory_order_relaxed);
+    return detected < level ? detected : level;
+}
+
+void set_simd_level(SimdLevel level) { max_level.store(level, std::memory_order_relaxed); }
+
+
+static void deinterleave_u8_to_float_scalar(const unsigned char* src, int i0, int n, int c, float* const* dst)
+{
+    for (int k = 0; k < c; ++k)
+        for (int i = i0; i < n; ++i)
+            dst[k][i] = static_cast<float>(src[i * c + k]) / 255.f;
+}
+
+static void interleave_float_to_u8_scalar(const float* const* src, int i0, int n, int c, unsigned char* dst)
+{
+    for (int k = 0; k < c; ++k)
+        for (int i = i0; i < n; ++i)
+            dst[i * c + k] = static_cast<unsigned char>(std::roundf(255 * src[k][i]));
+}
+
+#ifdef SRIMG_X86_SIMD
+// Byte shuffles between 8 interleaved pixels (8*c bytes, in 16-byte chunks)
+// and 8 bytes per channel. -128 zeroes the byte in pshufb.
+struct InterleaveMasks
+{
+    // deinterleave: channel k from chunk j
+    alignas(16) signed char load[4][2][16];
+    // interleave: chunk j from the channel pairs (0,1) and (2,3), each
+    // pair packed in one register as 8 + 8 bytes
+    alignas(16) signed char store[2][2][16];
+
+    explicit InterleaveMasks(int c)
+    {
+        for (int k = 0; k < 4; ++k)
+            for (int j = 0; j < 2; ++j)
+                for (int p = 0; p < 16; ++p) {
+                    int o = p * c + k - 16 * j;
+                    load[k][j][p] = (p < 8 && k < c && o >= 0 && o < 16) ? o : -128;
+                }
+        for (int j = 0; j < 2; ++j)
+            for (int t = 0; t < 16; ++t) {
+                int o = 16 * j + t, p = o / c, k = o % c;
+                bool valid = o < 8 * c;
+                store[j][0][t] = (valid && k < 2) ? k * 8 + p : -128;
+                store[j][1][t] = (valid && k >= 2) ? (k - 2) * 8 + p : -128;
+            }
+    }
+};
+
+static const InterleaveMasks& interleave_masks(int c)
+{
+    static const InterleaveMasks masks[4] = {InterleaveMasks(1), InterleaveMasks(2), InterleaveMasks(3), InterleaveMasks(4)};
+    return masks[c - 1];
+}
+
+// 8 pixels per iteration: 8*c bytes are read as one or two 16-byte chunks
+// (the second one possibly half), never past the end of src
+__attribute__((target("avx2")))
+static int deinterleave_u8_to_float_avx2(const unsigned char* src, int n, int c, float* const* dst)
+{
+    const InterleaveMasks& masks = interleave_masks(c);
+    const __m256 scale = _mm256_set1_ps(255.f);
+    const int bytes = 8 * c;
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const unsigned char* s = src + static_cast<size_t>(i) * c;
+        __m128i chunk[2];
+        chunk[0] = bytes >= 16 ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(s))
+                               : _mm_loadl_epi64(reinterpret_cast<const __m128i*>(s));
+        chunk[1] = bytes == 32 ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 16))
+                 : bytes == 24 ? _mm_loadl_epi64(reinterpret_cast<const __m128i*>(s + 16))
+                               : _mm_setzero_si128();
+        for (int k = 0; k < c; ++k) {
+            __m128i b = _mm_or_si128(
+                _mm_shuffle_epi8(chunk[0], _mm_load_si128(reinterpret_cast<const __m128i*>(masks.load[k][0]))),
+                _mm_shuffle_epi8(chunk[1], _mm_load_si128(reinterpret_cast<const __m128i*>(masks.load[k][1]))));
+            __m256 v = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b));
+            _mm256_storeu_ps(dst[k] + i, _mm256_div_ps(v, scale));
+        }
+    }
+    return i;
+}
+
+// roundf(255*v) then the conversion to unsigned char: rounding half away from
+// zero, exact since v - trunc(v) is; the low byte of the truncated int32 as
+// in the scalar cast
+__attribute__((target("avx2")))
+static __m128i float_to_u8_avx2(const float* src)
+{
+    const __m256 half = _mm256_set1_ps(0.5f), one = _mm256_set1_ps(1.0f);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 v = _mm256_mul_ps(_mm256_set1_ps(255.f), _mm256_loadu_ps(src));
+    __m256 t = _mm256_round_ps(v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    __m256 frac = _mm256_andnot_ps(sign, _mm256_sub_ps(v, t));
+    __m256 step = _mm256_or_ps(_mm256_and_ps(v, sign), one);
+    __m256 r = _mm256_add_ps(t, _mm256_and_ps(_mm256_cmp_ps(frac, half, _CMP_GE_OQ), step));
+    __m256i x = _mm256_and_si256(_mm256_cvttps_epi32(r), _mm256_set1_epi32(0xff));
+    __m128i w = _mm_packus_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+    return _mm_packus_epi16(w, w);
+}
+
+__attribute__((target("avx2")))
+static int interleave_float_to_u8_avx2(const float* const* src, int n, int c, unsigned char* dst)
+{
+    const InterleaveMasks& masks = interleave_masks(c);
+    const int bytes = 8 * c;
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i b[4] = {};
+        for (int k = 0; k < c; ++k) b[k] = float_to_u8_avx2(src[k] + i);
+        __m128i pair[2] = {_mm_unpacklo_epi64(b[0], b[1]), _mm_unpacklo_epi64(b[2], b[3])};
+        unsigned char* d = dst + static_cast<size_t>(i) * c;
+        for (int j = 0; j * 16 < bytes; ++j) {
+            __m128i out = _mm_or_si128(
+                _mm_shuffle_epi8(pair[0], _mm_load_si128(reinterpret_cast<const __m128i*>(masks.store[j][0]))),
+                _mm_shuffle_epi8(pair[1], _mm_load_si128(reinterpret_cast<const __m128i*>(masks.store[j][1]))));
+            if (bytes - j * 16 >= 16) _mm_storeu_si128(reinterpret_cast<__m128i*>(d + j * 16), out);
+            else _mm_storel_epi64(reinterpret_cast<__m128i*>(d + j * 16), out);
+        }
+    }
+    return i;
+}
+#endif
+
+void deinterleave_u8_to_float(const unsigned char* src, int n, int c, float* const* dst)
+{
+    int i = 0;
+#ifdef SRIMG_X86_SIMD
+    if (c >= 1 && c <= 4 && simd_level() >= SimdLevel::AVX2) i = deinterleave_u8_to_float_avx2(src, n, c, dst);
+#endif
+    deinterleave_u8_to_float_scalar(src, i, n, c, dst);
+}
+
+void interleave_float_to_u8(const float* const* src, int n, int c, unsigned char* dst)
+{
+    int i = 0;
+#ifdef SRIMG_X86_SIMD
+    if (c >= 1 && c <= 4 && simd_level() >= SimdLevel::AVX2) i = interleave_float_to_u8_avx2(src, n, c, dst);
+#endif
+    interleave_float_to_u8_scalar(src, i, n, c, dst);
+}
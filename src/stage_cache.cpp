@@ -0,0 +1,165 @@
+#include <bit>
+#include <cstring>
+#include <ios>
+
+#include <sys/stat.h>
+
+#include "../include/stage_cache.h"
+
+static const uint64_t HASH_K1 = 0x9E3779B97F4A7C15ull;
+static const uint64_t HASH_K2 = 0xBF58476D1CE4E5B9ull;
+
+static inline uint64_t hash_mix(uint64_t h, uint64_t v) { return std::rotl(h ^ (v * HASH_K1), 31) * HASH_K2; }
+
+// splitmix64 finalizer, so that every input bit affects every output bit
+static inline uint64_t hash_final(uint64_t h)
+{
+    h = (h ^ (h >> 30)) * HASH_K2;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+    return h ^ (h >> 31);
+}
+
+static uint64_t hash_bytes(uint64_t h, const void* data, size_t n)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    // four independent lanes over 32-byte blocks, the multiplications overlap
+    uint64_t lanes[4] = {h, h + HASH_K1, h + HASH_K2, h - HASH_K1};
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+        for (int k = 0; k < 4; k++) {
+            uint64_t v;
+            memcpy(&v, p + i + 8 * k, 8);
+            lanes[k] = hash_mix(lanes[k], v);
+        }
+    for (int k = 0; k < 4; k++) h = hash_mix(h, lanes[k]);
+    for (; i < n; i++) h = hash_mix(h, p[i]);
+    return hash_mix(h, n);
+}
+
+uint64_t image_hash(ConstImageView im)
+{
+    uint64_t h = hash_mix(hash_mix(hash_mix(0, im.w), im.h), im.c);
+    for (int k = 0; k < im.c; k++)
+        for (int y = 0; y < im.h; y++) h = hash_bytes(h, im.RowPtr(y, k).data(), im.w * sizeof(float));
+    return hash_final(h);
+}
+
+uint64_t stage_key(uint64_t input, std::string_view stage, std::initializer_list<double> params)
+{
+    uint64_t h = hash_bytes(hash_mix(0, input), stage.data(), stage.size());
+    for (double p : params) h = hash_mix(h, std::bit_cast<uint64_t>(p));
+    return hash_final(h);
+}
+
+
+uint64_t StageCache::file_key(const std::string& filename)
+{
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) throw std::ios_base::failure("Cannot load image " + filename);
+    uint64_t h = hash_bytes(0, filename.data(), filename.size());
+    h = hash_mix(h, st.st_size);
+    h = hash_mix(h, st.st_mtim.tv_sec);
+    h = hash_mix(h, st.st_mtim.tv_nsec);
+    return hash_final(h);
+}
+
+std::shared_ptr<const Image> StageCache::load_image(const std::string& filename)
+{
+    return get<Image>(stage_key(file_key(filename), "load_image"), [&] { return ::load_image(filename); });
+}
+
+std::shared_ptr<const Image> StageCache::load_image_gray(const std::string& filename)
+{
+    return get<Image>(stage_key(file_key(filename), "load_image_gray"), [&] { return ::load_image_gray(filename); });
+}
+
+std::shared_ptr<const void> StageCache::find(uint64_t key)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = index.find(key);
+    if (it == index.end()) {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->value;
+}
+
+void StageCache::insert(uint64_t key, std::shared_ptr<const void> value, size_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (size > max_bytes || index.count(key)) return;
+    while (bytes + size > max_bytes) {
+        const Entry& last = lru.back();
+        bytes -= last.bytes;
+        index.erase(last.key);
+        lru.pop_back();
+        evictions++;
+    }
+    lru.push_front({key, std::move(value), size});
+    index[key] = lru.begin();
+    bytes += size;
+}
+
+StageCacheStats StageCache::stats(void) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    StageCacheStats s;
+    s.hits = hits;
+    s.misses = misses;
+    s.evictions = evictions;
+    s.entries = lru.size();
+    s.bytes = bytes;
+    return s;
+}
+
+void StageCache::clear(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    lru.clear();
+    index.clear();
+    bytes = 0;
+}
+
+
+// The stages of canny() from a gray image whose key is key
+static std::shared_ptr<const Image> canny_stages(StageCache& cache, uint64_t key, ConstImageView im, const CannyParams& params)
+{
+    assert(im.c == 1);
+    uint64_t smooth_key = stage_key(key, "smooth_image", {params.sigma});
+    auto smooth = cache.get<Image>(smooth_key, [&] { return smooth_image(im, params.sigma); });
+
+    uint64_t grad_key = stage_key(smooth_key, "compute_gradient");
+    auto grad = cache.get<pair<Image,Image>>(grad_key, [&] { return compute_gradient(*smooth); });
+
+    // the histogram is kept for the automatic thresholds of later runs
+    uint64_t nms_key = stage_key(grad_key, "non_maximum_suppression");
+    auto nms = cache.get<pair<Image,MagnitudeHistogram>>(nms_key, [&] {
+        MagnitudeHistogram hist;
+        Image suppressed = non_maximum_suppression(grad->first, grad->second, hist);
+        return std::make_pair(std::move(suppressed), std::move(hist));
+    });
+
+    float low = params.low, high = params.high;
+    if (params.thresholds != ThresholdMethod::Manual) std::tie(low, high) = auto_thresholds(nms->second, params.thresholds);
+    uint64_t dt_key = stage_key(nms_key, "double_thresholding", {low, high, params.strong, params.weak});
+    auto dt = cache.get<Image>(dt_key, [&] { return double_thresholding(nms->first, low, high, params.strong, params.weak); });
+
+    uint64_t edges_key = stage_key(dt_key, "edge_tracking", {params.weak, params.strong});
+    return cache.get<Image>(edges_key, [&] { return edge_tracking(*dt, params.weak, params.strong); });
+}
+
+std::shared_ptr<const Image> canny_cached(StageCache& cache, ConstImageView im, const CannyParams& params)
+{
+    return canny_stages(cache, image_hash(im), im, params);
+}
+
+std::shared_ptr<const Image> canny_cached(StageCache& cache, const std::string& filename, const CannyParams& params)
+{
+    // one key for the pixels and the stages, so that a file replaced
+    // meanwhile cannot put results of the old pixels under the new key
+    uint64_t key = stage_key(StageCache::file_key(filename), "load_image_gray");
+    std::shared_ptr<const Image> gray = cache.get<Image>(key, [&] { return ::load_image_gray(filename); });
+    return canny_stages(cache, key, *gray, params);
+}
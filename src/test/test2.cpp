@@ -1,4 +1,14 @@
 #include "image.h"
+#include "simd.h"
+#include "parallel.h"
+#include "image_pool.h"
+#include "image_t.h"
+#include "interleaved_image.h"
+#include "mapped_image.h"
+#include "edge_map.h"
+#include "frame_stream.h"
+#include "stage_cache.h"
+#include <fstream>
 #include <string>
 #include  "definitions.hpp"
 #define BOOST_TEST_MODULE Test_Canny
@@ -20,14 +30,43 @@ BOOST_AUTO_TEST_CASE(test_smooth_image)
 }
 
 
+BOOST_AUTO_TEST_CASE(test_smooth_image_methods)
+{
+    Image im = load_image(ROOT_DIR / "data/iguana.jpg");
+    im = rgb_to_grayscale(im);
+
+    auto max_diff = [](const Image& a, const Image& b) {
+        float d = 0;
+        for (int i = 0; i < a.size(); i++) d = std::max(d, fabsf(a.data[i] - b.data[i]));
+        return d;
+    };
+    auto mean_diff = [](const Image& a, const Image& b) {
+        double d = 0;
+        for (int i = 0; i < a.size(); i++) d += fabsf(a.data[i] - b.data[i]);
+        return d / a.size();
+    };
+
+    // the separable filter is the 2D one up to rounding
+    Image ref = convolve_image(im, make_gaussian_filter(1.4), true);
+    BOOST_TEST(max_diff(smooth_image_separable(im, 1.4), ref) < 1e-5);
+
+    // the recursive filter approximates the Gaussian
+    ref = convolve_image(im, make_gaussian_filter(4), true);
+    Image rec = smooth_image_recursive(im, 4);
+    BOOST_TEST(max_diff(rec, ref) < 0.03);
+    BOOST_TEST(mean_diff(rec, ref) < 0.005);
+    BOOST_TEST(smooth_image(im, 4).data == rec.data);
+}
+
+
 BOOST_AUTO_TEST_CASE(test_gradient)
 {
     Image im = load_image(ROOT_DIR / "data/iguana.jpg");
     im = rgb_to_grayscale(im);
     im = smooth_image(im, 1.4);
     pair<Image,Image> grad = compute_gradient(im);
-    Image mag = grad.first;
-    Image dir = grad.second;
+    Image mag = std::move(grad.first);
+    Image dir = std::move(grad.second);
     feature_normalize(dir);
     mag.save_png(ROOT_DIR / "output/mag_iguana");
     dir.save_png(ROOT_DIR / "output/dir_iguana");
@@ -44,8 +83,8 @@ BOOST_AUTO_TEST_CASE(test_non_max_suppression)
     im = rgb_to_grayscale(im);
     im = smooth_image(im, 1.4);
     pair<Image,Image> grad = compute_gradient(im);
-    Image mag = grad.first;
-    Image dir = grad.second;
+    Image mag = std::move(grad.first);
+    Image dir = std::move(grad.second);
     Image nms = non_maximum_suppression(mag, dir);
     nms.save_png(ROOT_DIR / "output/nms_iguana");
     Image check_nms = load_image(ROOT_DIR / "data/nms_iguana.png");
@@ -60,8 +99,8 @@ BOOST_AUTO_TEST_CASE(test_double_thresholding)
     im = rgb_to_grayscale(im);
     im = smooth_image(im, 1.4);
     pair<Image,Image> grad = compute_gradient(im);
-    Image mag = grad.first;
-    Image dir = grad.second;
+    Image mag = std::move(grad.first);
+    Image dir = std::move(grad.second);
     Image nms = non_maximum_suppression(mag, dir);
     Image dt = double_thresholding(nms, 0.03, 0.17, 1.0, 0.25);
     dt.save_png(ROOT_DIR / "output/double_threshold_iguana");
@@ -76,8 +115,8 @@ BOOST_AUTO_TEST_CASE(test_edge_tracking)
     im = rgb_to_grayscale(im);
     im = smooth_image(im, 1.4);
     pair<Image,Image> grad = compute_gradient(im);
-    Image mag = grad.first;
-    Image dir = grad.second;
+    Image mag = std::move(grad.first);
+    Image dir = std::move(grad.second);
     Image nms = non_maximum_suppression(mag, dir);
     float strong = 1.0;
     float weak = 0.25;
@@ -89,3 +128,921 @@ BOOST_AUTO_TEST_CASE(test_edge_tracking)
 }
 
 
+
+BOOST_AUTO_TEST_CASE(test_canny_fused)
+{
+    Image im = load_image(ROOT_DIR / "data/iguana.jpg");
+    im = rgb_to_grayscale(im);
+    CannyParams params;
+    Image smooth = smooth_image(im, params.sigma);
+    pair<Image,Image> grad = compute_gradient(smooth);
+    Image nms = non_maximum_suppression(grad.first, grad.second);
+    Image dt = double_thresholding(nms, params.low, params.high, params.strong, params.weak);
+    Image staged = edge_tracking(dt, params.weak, params.strong);
+
+    Image fused = canny_fused(im, params);
+    BOOST_TEST(fused.data == staged.data);
+    Image et_check = load_image(ROOT_DIR / "data/edge_track_iguana.png");
+    BOOST_TEST(same_image(fused, et_check));
+}
+
+BOOST_AUTO_TEST_CASE(test_edge_tracking_connected)
+{
+    float strong = 1.0;
+    float weak = 0.25;
+
+    // a weak chain connected to a strong pixel at one end, and an isolated weak segment
+    Image line(200, 3, 1);
+    line(0, 1) = strong;
+    for (int x = 1; x <= 150; x++) line(x, 1) = weak;
+    for (int x = 152; x < 200; x++) line(x, 1) = weak;
+    Image et = edge_tracking_connected(line, weak, strong);
+    for (int x = 0; x < 200; x++) BOOST_TEST(et(x, 1) == (x <= 150 ? strong : 0));
+
+    // a diagonal chain crossing the boundaries of the parallel bands
+    Image diag(600, 600, 1);
+    for (int y = 0; y < 600; y++) diag(y, y) = weak;
+    diag(599, 599) = strong;
+    et = edge_tracking_connected(diag, weak, strong, 8);
+    BOOST_TEST(et(0, 0) == strong);
+    BOOST_TEST(et(300, 300) == strong);
+
+    Image im = load_image(ROOT_DIR / "data/iguana.jpg");
+    im = rgb_to_grayscale(im);
+    im = smooth_image(im, 1.4);
+    pair<Image,Image> grad = compute_gradient(im);
+    Image nms = non_maximum_suppression(grad.first, grad.second);
+    Image dt = double_thresholding(nms, 0.03, 0.17, strong, weak);
+    Image single = edge_tracking_connected(dt, weak, strong, 1);
+    Image parallel = edge_tracking_connected(dt, weak, strong, 4);
+    BOOST_TEST(single.data == parallel.data);
+    // every edge kept by the neighbour check is kept by the connected components
+    Image et_check = edge_tracking(dt, weak, strong);
+    bool superset = true;
+    for (int i = 0; i < et_check.size(); i++) if (et_check.data[i] == strong && single.data[i] != strong) superset = false;
+    BOOST_TEST(superset);
+}
+
+BOOST_AUTO_TEST_CASE(test_gradient_sectors)
+{
+    Image im = load_image(ROOT_DIR / "data/iguana.jpg");
+    im = rgb_to_grayscale(im);
+    im = smooth_image(im, 1.4);
+    pair<Image,Image> grad = compute_gradient(im);
+    pair<Image,SectorImage> grad_sectors = compute_gradient_sectors(im);
+    BOOST_TEST(grad_sectors.first.data == grad.first.data);
+
+    Image nms = non_maximum_suppression(grad_sectors.first, grad_sectors.second);
+    BOOST_TEST(nms.data == non_maximum_suppression(grad.first, grad.second).data);
+    Image check_nms = load_image(ROOT_DIR / "data/nms_iguana.png");
+    BOOST_TEST(same_image(nms, check_nms));
+}
+
+BOOST_AUTO_TEST_CASE(test_non_max_suppression_simd)
+{
+    Image im = load_image(ROOT_DIR / "data/iguana.jpg");
+    im = rgb_to_grayscale(im);
+    im = smooth_image(im, 1.4);
+    pair<Image,SectorImage> grad = compute_gradient_sectors(im);
+
+    // every vector kernel gives the same result as the scalar one
+    set_simd_level(SimdLevel::Scalar);
+    Image scalar = non_maximum_suppression(grad.first, grad.second);
+    set_simd_level(SimdLevel::AVX2);
+    Image avx2 = non_maximum_suppression(grad.first, grad.second);
+    set_simd_level(SimdLevel::AVX512);
+    Image avx512 = non_maximum_suppression(grad.first, grad.second);
+    BOOST_TEST(avx2.data == scalar.data);
+    BOOST_TEST(avx512.data == scalar.data);
+
+    // odd width, to go through the scalar tails
+    Image odd(61, 7, 1);
+    for (int y = 0; y < odd.h; y++) for (int x = 0; x < odd.w; x++) odd(x, y) = im(x + 100, y + 100);
+    grad = compute_gradient_sectors(odd);
+    set_simd_level(SimdLevel::Scalar);
+    scalar = non_maximum_suppression(grad.first, grad.second);
+    set_simd_level(SimdLevel::AVX512);
+    BOOST_TEST(non_maximum_suppression(grad.first, grad.second).data == scalar.data);
+}
+
+BOOST_AUTO_TEST_CASE(test_pixel_conversion_simd)
+{
+    // every byte value, and floats around every rounding boundary (255*v is
+    // exactly x.5 for some of them) and out of [0,1]
+    const int n = 70000 + 5;
+    std::vector<unsigned char> bytes(4 * n);
+    for (size_t i = 0; i < bytes.size(); i++) bytes[i] = (i * 7) % 256;
+    std::vector<float> values(4 * n);
+    for (size_t i = 0; i < values.size(); i++) values[i] = (static_cast<int>(i % n) - 3000) / 65536.0f;
+
+    for (int c = 1; c <= 4; c++) {
+        auto run = [&](SimdLevel level) {
+            set_simd_level(level);
+            std::vector<float> planar(c * n);
+            std::vector<float*> dst(c);
+            std::vector<const float*> src(c);
+            for (int k = 0; k < c; k++) {
+                dst[k] = planar.data() + k * n;
+                src[k] = values.data() + k * n;
+            }
+            deinterleave_u8_to_float(bytes.data(), n, c, dst.data());
+            std::vector<unsigned char> interleaved(c * n);
+            interleave_float_to_u8(src.data(), n, c, interleaved.data());
+            return std::make_pair(planar, interleaved);
+        };
+        auto scalar = run(SimdLevel::Scalar);
+        auto avx2 = run(SimdLevel::AVX2);
+        BOOST_TEST(scalar.first == avx2.first);
+        BOOST_TEST(scalar.second == avx2.second);
+        BOOST_TEST(scalar.first[(c - 1) * n + 1] == static_cast<float>(bytes[2 * c - 1]) / 255.f);
+    }
+    set_simd_level(SimdLevel::AVX512);
+
+    // load and save keep their values
+    Image rgb = load_image(ROOT_DIR / "data/iguana.jpg");
+    InterleavedImage hwc = load_image_interleaved(ROOT_DIR / "data/iguana.jpg");
+    BOOST_TEST(hwc(5, 7, 2) == rgb(5, 7, 2));
+    rgb.save_png((ROOT_DIR / "output/iguana_roundtrip").string());
+    BOOST_TEST(load_image(ROOT_DIR / "output/iguana_roundtrip.png").data == rgb.data);
+}
+
+BOOST_AUTO_TEST_CASE(test_padded_image)
+{
+    Image im = load_image(ROOT_DIR / "data/iguana.jpg");
+    im = rgb_to_grayscale(im);
+    im = smooth_image(im, 1.4);
+
+    // rows start on 64-byte boundaries and the halo replicates the border
+    PaddedImage padded(im, 3);
+    BOOST_TEST(padded.to_image().data == im.data);
+    bool aligned = true, clamped = true;
+    for (int y = -3; y < im.h + 3; y++) {
+        aligned &= reinterpret_cast<uintptr_t>(padded.RowPtr(y, 0).data()) % PaddedImage::ALIGNMENT == 0;
+        for (int x = -3; x < im.w + 3; x++) clamped &= padded.RowPtr(y, 0).data()[x] == im.clamped_pixel(x, y, 0);
+    }
+    BOOST_TEST(aligned);
+    BOOST_TEST(clamped);
+
+    // out-of-range channels are clamped as by get_clamped_pixel()
+    Image two(3, 2, 2);
+    for (int i = 0; i < two.size(); i++) two.data[i] = i;
+    for (int ch : {-1, 0, 1, 2, 7})
+        BOOST_TEST(two.clamped_pixel(4, -1, ch) == get_clamped_pixel(two, 4, -1, ch));
+
+    // reflection around the border pixel
+    Image line(4, 1, 1);
+    for (int x = 0; x < 4; x++) line(x, 0) = x;
+    PaddedImage reflected(line, 5, BorderMode::Reflect);
+    const float* row = reflected.RowPtr(0, 0).data();
+    std::vector<float> expected = {1, 2, 3, 2, 1, 0, 1, 2, 3, 2, 1, 0, 1};
+    BOOST_TEST(std::vector<float>(row - 5, row + 8) == expected);
+    BOOST_TEST(reflected(2, -2, 0) == 2);
+
+    // non-maximum suppression reads the neighbours from the halo
+    pair<Image,SectorImage> grad = compute_gradient_sectors(im);
+    Image nms = non_maximum_suppression(grad.first, grad.second);
+    BOOST_TEST(non_maximum_suppression(PaddedImage(grad.first, 1), grad.second).data == nms.data);
+    Image odd(61, 7, 1);
+    for (int y = 0; y < odd.h; y++) for (int x = 0; x < odd.w; x++) odd(x, y) = im(x + 100, y + 100);
+    grad = compute_gradient_sectors(odd);
+    nms = non_maximum_suppression(grad.first, grad.second);
+    for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::AVX2, SimdLevel::AVX512}) {
+        set_simd_level(level);
+        BOOST_TEST(non_maximum_suppression(PaddedImage(grad.first, 1), grad.second).data == nms.data);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_image_view)
+{
+    Image rgb = load_image(ROOT_DIR / "data/iguana.jpg");
+    Image im = rgb_to_grayscale(rgb);
+
+    // a region processed in place gives the same result as a copy of it
+    ConstImageView roi = im.view().roi(37, 21, 150, 90);
+    Image crop(roi);
+    BOOST_TEST(crop(0, 0) == im(37, 21));
+    BOOST_TEST(crop(149, 89) == im(186, 110));
+    BOOST_TEST(smooth_image(roi, 1.4).data == smooth_image(crop, 1.4).data);
+    BOOST_TEST(smooth_image(roi, 4).data == smooth_image(crop, 4).data);
+    pair<Image,Image> grad = compute_gradient(roi);
+    BOOST_TEST(grad.first.data == compute_gradient(crop).first.data);
+    Image nms = non_maximum_suppression(grad.first.view().roi(10, 10, 100, 50), grad.second.view().roi(10, 10, 100, 50));
+    BOOST_TEST(nms.data == non_maximum_suppression(Image(grad.first.view().roi(10, 10, 100, 50)),
+                                                   Image(grad.second.view().roi(10, 10, 100, 50))).data);
+    Image dt = double_thresholding(nms, 0.03, 0.17, 1.0, 0.25);
+    BOOST_TEST(edge_tracking(dt.view().roi(5, 5, 60, 30), 0.25, 1.0).data == edge_tracking(Image(dt.view().roi(5, 5, 60, 30)), 0.25, 1.0).data);
+    BOOST_TEST(canny_fused(roi).data == canny_fused(crop).data);
+
+    // channels are views of the parent planes
+    for (int k = 0; k < rgb.c; k++) {
+        ConstImageView channel = rgb.view().channel(k);
+        BOOST_TEST(channel.RowPtr(0, 0).data() == rgb.RowPtr(0, k).data());
+        BOOST_TEST(convolve_image(channel, make_gx_filter(), false).data == convolve_image(rgb.get_channel(k), make_gx_filter(), false).data);
+    }
+
+    // writes through a view land in the parent
+    ImageView corner = im.view().roi(im.w - 2, im.h - 2, 2, 2);
+    corner(1, 1) = 0.5f;
+    BOOST_TEST(im(im.w - 1, im.h - 1) == 0.5f);
+
+    // the interior of a padded image is a strided view
+    PaddedImage padded(crop, 2);
+    BOOST_TEST(!padded.view().is_contiguous());
+    BOOST_TEST(Image(padded.view()).data == crop.data);
+}
+
+BOOST_AUTO_TEST_CASE(test_image_pool)
+{
+    Image im = load_image(ROOT_DIR / "data/iguana.jpg");
+    im = rgb_to_grayscale(im);
+    Image expected = edge_tracking(double_thresholding(non_maximum_suppression(compute_gradient_sectors(smooth_image(im, 1.4)).first,
+                                                                               compute_gradient_sectors(smooth_image(im, 1.4)).second),
+                                                       0.03, 0.17, 1.0, 0.25), 0.25, 1.0);
+
+    // a stream of frames through the staged pipeline, every stage output
+    // going back to the pool once the next stage has used it
+    ImagePool pool;
+    set_image_pool(&pool);
+    auto frame = [&]() {
+        PooledImage smooth(pool, smooth_image(im, 1.4));
+        pair<Image,SectorImage> grad = compute_gradient_sectors(*smooth);
+        PooledImage mag(pool, std::move(grad.first));
+        PooledImage nms(pool, non_maximum_suppression(*mag, grad.second));
+        PooledImage dt(pool, double_thresholding(*nms, 0.03, 0.17, 1.0, 0.25));
+        PooledImage edges(pool, edge_tracking(*dt, 0.25, 1.0));
+        PooledImage fused(pool, canny_fused(im));
+        return edges->data == expected.data && fused->data == expected.data;
+    };
+    BOOST_TEST(frame());
+    ImagePoolStats first = pool.stats();
+    BOOST_TEST(first.misses > 0);
+    for (int i = 0; i < 3; i++) BOOST_TEST(frame());
+    ImagePoolStats steady = pool.stats();
+    set_image_pool(nullptr);
+
+    // after the first frame every buffer is recycled
+    BOOST_TEST(steady.misses == first.misses);
+    BOOST_TEST(steady.hits > first.hits);
+    BOOST_TEST(steady.buffers == first.buffers);
+    BOOST_TEST(steady.bytes > 0u);
+
+    // buffers beyond the size limit are freed
+    ImagePool small(1000);
+    small.release(Image(10, 10, 1));
+    small.release(Image(10, 10, 3));
+    BOOST_TEST(small.stats().buffers == 1u);
+    Image recycled = small.acquire(10, 10, 1);
+    BOOST_TEST(recycled.size() == 100);
+    BOOST_TEST(small.stats().hits == 1u);
+    small.acquire(10, 10, 1);
+    BOOST_TEST(small.stats().misses == 1u);
+}
+
+BOOST_AUTO_TEST_CASE(test_narrow_pixel_types)
+{
+    // u8 loading and conversions are exact round trips
+    Image rgb = load_image(ROOT_DIR / "data/iguana.jpg");
+    ImageU8 rgb8 = load_image_u8(ROOT_DIR / "data/iguana.jpg");
+    BOOST_TEST(to_image(rgb8).data == rgb.data);
+    BOOST_TEST(convert_image<uint8_t>(rgb).data == rgb8.data);
+    ImageU16 rgb16 = convert_image<uint16_t>(rgb8);
+    BOOST_TEST(rgb16(3, 5, 1) == rgb8(3, 5, 1) * 257);
+    BOOST_TEST(convert_image<uint8_t>(rgb16).data == rgb8.data);
+
+    // saturation and rounding half away from zero
+    Image levels(4, 1, 1);
+    levels(0, 0) = -0.5f;
+    levels(1, 0) = 1.5f;
+    levels(2, 0) = 0.5f / 255;
+    levels(3, 0) = 0.49f / 255;
+    std::vector<uint8_t> expected_levels = {0, 255, 1, 0};
+    BOOST_TEST(convert_image<uint8_t>(levels).data == expected_levels);
+
+    Image im = rgb_to_grayscale(rgb);
+    ImageU8 im8 = convert_image<uint8_t>(im);
+
+    // the u8 smoothing is within one level of the float one
+    Image smooth = smooth_image(to_image(im8), 1.4);
+    ImageU8 smooth8 = smooth_image(im8, 1.4);
+    int max_diff = 0;
+    for (int i = 0; i < smooth8.size(); i++)
+        max_diff = std::max(max_diff, std::abs(smooth8.data[i] - convert_pixel<uint8_t>(smooth.data[i])));
+    BOOST_TEST(max_diff <= 1);
+
+    // the int16 Sobel is exact
+    pair<ImageS16,ImageS16> sobel = sobel_image_s16(smooth8);
+    Image smooth_levels = to_image(smooth8);
+    Image gx = convolve_image(smooth_levels, make_gx_filter(), false);
+    bool exact = true;
+    for (int i = 0; i < gx.size(); i++) exact &= std::abs(sobel.first.data[i] - gx.data[i] * 8 * 255) < 1e-2f;
+    BOOST_TEST(exact);
+
+    // edges from the u8 pipeline agree with the float one almost everywhere
+    Image edges = canny_fused(to_image(im8));
+    Image edges8 = canny_u8(im8);
+    int same = 0;
+    for (int i = 0; i < edges.size(); i++) same += edges8.data[i] == edges.data[i];
+    BOOST_TEST(same >= 0.99 * edges.size());
+}
+
+BOOST_AUTO_TEST_CASE(test_interleaved_image)
+{
+    Image rgb = load_image(ROOT_DIR / "data/iguana.jpg");
+    InterleavedImageU8 rgb8 = load_image_interleaved_u8(ROOT_DIR / "data/iguana.jpg");
+    InterleavedImage rgbf = load_image_interleaved(ROOT_DIR / "data/iguana.jpg");
+    BOOST_TEST(rgb8.c == 3);
+    BOOST_TEST(rgbf(10, 20, 2) == rgb(10, 20, 2));
+    BOOST_TEST(rgbf.PixelPtr(10, 20)[1] == rgb(10, 20, 1));
+    BOOST_TEST(to_planar(rgb8).data == rgb.data);
+    BOOST_TEST(to_planar(rgbf).data == rgb.data);
+    BOOST_TEST(to_interleaved(rgb).data == rgbf.data);
+    BOOST_TEST(to_interleaved<uint8_t>(rgb).data == rgb8.data);
+
+    // colour conversions give the same pixels in both layouts
+    Image hsv = rgb;
+    rgb_to_hsv(hsv);
+    InterleavedImage hsvi = rgbf;
+    rgb_to_hsv(hsvi);
+    BOOST_TEST(to_planar(hsvi).data == hsv.data);
+    hsv_to_rgb(hsv);
+    hsv_to_rgb(hsvi);
+    BOOST_TEST(to_planar(hsvi).data == hsv.data);
+
+    // saving is the same file as from the planar image
+    save_image_interleaved(rgbf, ROOT_DIR / "output/interleaved_iguana");
+    rgb.save_png(ROOT_DIR / "output/planar_iguana");
+    BOOST_TEST(load_image(ROOT_DIR / "output/interleaved_iguana.png").data == load_image(ROOT_DIR / "output/planar_iguana.png").data);
+}
+
+BOOST_AUTO_TEST_CASE(test_image_expr)
+{
+    Image rgb = load_image(ROOT_DIR / "data/iguana.jpg");
+    Image a = rgb;
+    Image b = rgb;
+    rgb_to_hsv(b);
+    Image c = rgb_to_grayscale(rgb);
+    c = grayscale_to_rgb(c, 1, 1, 1);
+
+    // one fused pass gives the same values as element by element
+    ImagePool pool;
+    set_image_pool(&pool);
+    Image r = clamp((a - b) * 0.5f + c);
+    Image s = 2.0f * abs(-a) / (b + 1) - min(a, 0.25f);
+    set_image_pool(nullptr);
+    BOOST_TEST(pool.stats().misses == 2u); // one output buffer per expression
+    bool same_r = true, same_s = true;
+    for (int i = 0; i < a.size(); i++) {
+        float v = (a.data[i] - b.data[i]) * 0.5f + c.data[i];
+        same_r &= r.data[i] == (v > 1 ? 1 : (v < 0 ? 0 : v));
+        same_s &= s.data[i] == 2.0f * fabsf(-a.data[i]) / (b.data[i] + 1) - std::min(a.data[i], 0.25f);
+    }
+    BOOST_TEST(same_r);
+    BOOST_TEST(same_s);
+
+    // two Images, two expressions of the same type
+    Image lo = min(a, b), hi = max(a, b), lo2 = min(a + c, b + c);
+    bool same_minmax = true;
+    for (int i = 0; i < a.size(); i++)
+        same_minmax &= lo.data[i] == std::min(a.data[i], b.data[i]) && hi.data[i] == std::max(a.data[i], b.data[i])
+                    && lo2.data[i] == std::min(a.data[i] + c.data[i], b.data[i] + c.data[i]);
+    BOOST_TEST(same_minmax);
+
+    // the destination may be an operand
+    Image twice = a + a;
+    a = a * 2.0f;
+    BOOST_TEST(a.data == twice.data);
+
+    // the element-wise functions of the library go through expressions
+    Image back = add_image(b, c) - c;
+    BOOST_TEST(back.w == b.w);
+    BOOST_TEST(back(3, 4, 2) == (b(3, 4, 2) + c(3, 4, 2)) - c(3, 4, 2));
+    Image shifted = c;
+    shift_image(shifted, 1, 0.5f);
+    scale_image(shifted, 1, 2.0f);
+    clamp_image(shifted);
+    BOOST_TEST(shifted(5, 7, 0) == c(5, 7, 0));
+    BOOST_TEST(shifted(5, 7, 1) == std::min(1.0f, (c(5, 7, 1) + 0.5f) * 2.0f));
+}
+
+BOOST_AUTO_TEST_CASE(test_into_variants)
+{
+    Image im = load_image(ROOT_DIR / "data/iguana.jpg");
+    im = rgb_to_grayscale(im);
+    CannyParams params;
+
+    Image smooth = smooth_image(im, params.sigma);
+    pair<Image,Image> grad = compute_gradient(smooth);
+    pair<Image,SectorImage> sect = compute_gradient_sectors(smooth);
+    Image nms = non_maximum_suppression(sect.first, sect.second);
+    Image dt = double_thresholding(nms, params.low, params.high, params.strong, params.weak);
+    Image edges = edge_tracking(dt, params.weak, params.strong);
+
+    // the same stages into buffers that are reused from one frame to the next
+    Image s, m, d, n, t, e, f;
+    SectorImage q;
+    for (int frame = 0; frame < 2; frame++) {
+        const float* buffers[] = {s.data.data(), m.data.data(), n.data.data(), t.data.data(), e.data.data()};
+        smooth_image_into(im, params.sigma, s);
+        compute_gradient_into(s, m, d);
+        BOOST_TEST(m.data == grad.first.data);
+        BOOST_TEST(d.data == grad.second.data);
+        compute_gradient_sectors_into(s, m, q);
+        non_maximum_suppression_into(m, q, n);
+        double_thresholding_into(n, params.low, params.high, params.strong, params.weak, t);
+        edge_tracking_into(t, params.weak, params.strong, e);
+        canny_fused_into(im, params, f);
+        BOOST_TEST(s.data == smooth.data);
+        BOOST_TEST(q.data == sect.second.data);
+        BOOST_TEST(n.data == nms.data);
+        BOOST_TEST(t.data == dt.data);
+        BOOST_TEST(e.data == edges.data);
+        BOOST_TEST(f.data == edges.data);
+        if (frame) {
+            const float* reused[] = {s.data.data(), m.data.data(), n.data.data(), t.data.data(), e.data.data()};
+            BOOST_TEST(std::equal(buffers, buffers + 5, reused));
+        }
+    }
+
+    // rvalue inputs are processed in place
+    Image tmp = nms;
+    const float* buffer = tmp.data.data();
+    Image in_place = double_thresholding(std::move(tmp), params.low, params.high, params.strong, params.weak);
+    BOOST_TEST(in_place.data.data() == buffer);
+    BOOST_TEST(in_place.data == dt.data);
+    Image big = smooth_image_recursive(std::move(in_place), 4.0f);
+    BOOST_TEST(big.data.data() == buffer);
+    BOOST_TEST(big.data == smooth_image_recursive(dt, 4.0f).data);
+    Image normalized = feature_normalize(sobel_image(im).first);
+    BOOST_TEST(normalized.data == compute_gradient(im).first.data);
+    Image clamped = clamp_image(im * 2.0f);
+    BOOST_TEST(clamped(3, 4) == std::min(1.0f, im(3, 4) * 2.0f));
+}
+
+BOOST_AUTO_TEST_CASE(test_mapped_image)
+{
+    Image rgb = load_image(ROOT_DIR / "data/iguana.jpg");
+    string path = (ROOT_DIR / "output/iguana.srimg").string();
+    save_mapped_image(rgb, path);
+
+    {
+        MappedImage mapped(path, true);
+        BOOST_TEST((mapped.type() == PixelType::F32));
+        ConstImageView v = mapped;
+        BOOST_TEST(v.w == rgb.w);
+        BOOST_TEST(v.c == 3);
+        BOOST_TEST(v.stride % 16 == 0);
+        BOOST_TEST(reinterpret_cast<uintptr_t>(v.ptr) % MappedImageHeader::ALIGNMENT == 0);
+        BOOST_TEST(Image(v).data == rgb.data);
+        // the stages read the mapping directly
+        BOOST_TEST(smooth_image(v.channel(1), 1.4f).data == smooth_image(rgb.get_channel(1), 1.4f).data);
+        BOOST_CHECK_THROW(mapped.view<uint8_t>(), std::runtime_error);
+    }
+
+    ImageU8 im8 = convert_image<uint8_t>(rgb.view());
+    save_mapped_image(im8, path);
+    MappedImage mapped8 = map_image(path);
+    BasicImageView<const uint8_t> v8 = mapped8.view<uint8_t>();
+    BOOST_TEST(mapped8.verify());
+    BOOST_TEST(v8(5, 7, 2) == im8(5, 7, 2));
+    BOOST_TEST(v8(rgb.w - 1, rgb.h - 1, 0) == im8(rgb.w - 1, rgb.h - 1, 0));
+
+    // a flipped bit is caught by the checksum, a truncated file by the header check
+    string bad = (ROOT_DIR / "output/iguana_bad.srimg").string();
+    {
+        std::vector<char> bytes(mapped8.info().data_offset + mapped8.info().data_bytes);
+        FILE* fn = fopen(path.c_str(), "rb");
+        BOOST_REQUIRE(fread(bytes.data(), 1, bytes.size(), fn) == bytes.size());
+        fclose(fn);
+        bytes[mapped8.info().data_offset + 100] ^= 1;
+        fn = fopen(bad.c_str(), "wb");
+        fwrite(bytes.data(), 1, bytes.size() - 1, fn);
+        fclose(fn);
+        BOOST_CHECK_THROW(MappedImage m(bad), std::runtime_error);
+        fn = fopen(bad.c_str(), "wb");
+        fwrite(bytes.data(), 1, bytes.size(), fn);
+        fclose(fn);
+    }
+    BOOST_TEST(!MappedImage(bad).verify());
+    BOOST_CHECK_THROW(MappedImage m(bad, true), std::runtime_error);
+    BOOST_CHECK_THROW(MappedImage m(ROOT_DIR / "data/iguana.jpg"), std::runtime_error);
+
+    // sizes whose products wrap around, or a misaligned stride or plane, are rejected
+    // by the header check alone
+    auto corrupt = [&](auto edit) {
+        MappedImageHeader hd = mapped8.info();
+        edit(hd);
+        FILE* fn = fopen(bad.c_str(), "r+b");
+        fwrite(&hd, sizeof(hd), 1, fn);
+        fclose(fn);
+        BOOST_CHECK_THROW(MappedImage m(bad), std::runtime_error);
+    };
+    corrupt([](MappedImageHeader& hd) { hd.stride = uint64_t(1) << 62; hd.plane = 0; });
+    corrupt([](MappedImageHeader& hd) { hd.plane = (uint64_t(1) << 63) / 3 * 2 + 1; hd.data_bytes = hd.plane * 3; });
+    corrupt([](MappedImageHeader& hd) { hd.data_offset = UINT64_MAX - 63; });
+    corrupt([](MappedImageHeader& hd) { hd.stride += 1; });
+    corrupt([](MappedImageHeader& hd) { hd.plane += 1; hd.c = 1; hd.data_bytes = hd.plane; });
+}
+
+BOOST_AUTO_TEST_CASE(test_png_encoder)
+{
+    Image rgb = load_image(ROOT_DIR / "data/iguana.jpg");
+    Image im = rgb_to_grayscale(rgb);
+    CannyParams params;
+    Image edges = canny_fused(im, params);
+    string out = (ROOT_DIR / "output/png_encoder").string();
+
+    // every filter and level decodes to the pixels, many bands or a single one
+    for (PngFilter filter : {PngFilter::None, PngFilter::Sub, PngFilter::Up, PngFilter::Average, PngFilter::Paeth, PngFilter::Adaptive}) {
+        PngOptions opt;
+        opt.filter = filter;
+        opt.compression = filter == PngFilter::None ? 0 : (filter == PngFilter::Paeth ? 9 : 1);
+        opt.rows_per_band = filter == PngFilter::Sub ? 1 : (filter == PngFilter::Up ? rgb.h : 7);
+        save_png(rgb, out, opt);
+        BOOST_TEST(load_image(out + ".png").data == rgb.data);
+    }
+
+    // edge maps as 8-bit and 1-bit grayscale
+    PngOptions gray8, gray1;
+    gray8.format = PngFormat::Gray8;
+    gray1.format = PngFormat::Gray1;
+    vector<unsigned char> png8 = encode_png(edges, gray8);
+    vector<unsigned char> png1 = encode_png(edges, gray1);
+    BOOST_TEST(png1.size() < png8.size());
+    save_png(edges, out, gray1);
+    Image back = load_image(out + ".png");
+    BOOST_TEST(back.c == 1);
+    BOOST_TEST(back.data == edges.data);
+
+    // the bands do not depend on the number of threads
+    set_num_threads(1);
+    vector<unsigned char> serial = encode_png(rgb);
+    set_num_threads(0);
+    BOOST_TEST((serial == encode_png(rgb)));
+}
+
+BOOST_AUTO_TEST_CASE(test_edge_map)
+{
+    Image im = load_image(ROOT_DIR / "data/iguana.jpg");
+    im = rgb_to_grayscale(im);
+    CannyParams params;
+    pair<Image,Image> grad = compute_gradient(smooth_image(im, params.sigma));
+    Image nms = non_maximum_suppression(grad.first, grad.second);
+    Image dt = double_thresholding(nms, params.low, params.high, params.strong, params.weak);
+    Image edges = edge_tracking(dt, params.weak, params.strong);
+
+    // the stages on bits give the same edges as on floats
+    EdgeMap strong, weak;
+    double_thresholding_into(nms, params.low, params.high, strong, weak);
+    Image strong_only = dt;
+    for (float& v : strong_only.data) v = v == params.strong ? v : 0;
+    BOOST_TEST(to_image(strong, params.strong).data == strong_only.data);
+    EdgeMap tracked = edge_tracking(strong, weak);
+    BOOST_TEST(to_image(tracked).data == edges.data);
+    EdgeMap from_float;
+    edge_tracking_into(dt, params.weak, params.strong, from_float);
+    BOOST_TEST((from_float == tracked));
+    BOOST_TEST((to_edge_map(edges) == tracked));
+    BOOST_TEST(tracked.count() == static_cast<size_t>(std::count(edges.data.begin(), edges.data.end(), 1.0f)));
+    BOOST_TEST(tracked.data.size() * sizeof(uint64_t) * 32 == edges.data.size() * sizeof(float)); // 384 pixels wide
+
+    // run-length encoding, in memory and in files
+    std::vector<uint8_t> rle = encode_rle(tracked);
+    BOOST_TEST((decode_rle(rle, tracked.w, tracked.h) == tracked));
+    for (EdgeMapEncoding encoding : {EdgeMapEncoding::Bits, EdgeMapEncoding::RLE}) {
+        string path = (ROOT_DIR / "output/edges.srem").string();
+        save_edge_map(tracked, path, encoding);
+        BOOST_TEST((load_edge_map(path) == tracked));
+    }
+
+    // runs across rows, all set, empty, width not a multiple of 64
+    EdgeMap small(70, 3);
+    for (int x = 60; x < 70; x++) small.set(x, 0, true);
+    for (int x = 0; x < 70; x++) small.set(x, 1, true);
+    small.set(69, 2, true);
+    BOOST_TEST((decode_rle(encode_rle(small), 70, 3) == small));
+    EdgeMap empty(5, 0);
+    BOOST_TEST((decode_rle(encode_rle(empty), 5, 0) == empty));
+    BOOST_CHECK_THROW(decode_rle(rle, tracked.w, tracked.h - 1), std::runtime_error);
+
+    // padding bits set in a file are dropped, a payload larger than the file
+    // is rejected before allocating it (payload_bytes is at offset 24)
+    string path = (ROOT_DIR / "output/edges_bad.srem").string();
+    save_edge_map(EdgeMap(3, 2), path);
+    uint64_t ones[2] = {~uint64_t(0), ~uint64_t(0)};
+    FILE* fn = fopen(path.c_str(), "r+b");
+    fseek(fn, 32, SEEK_SET);
+    fwrite(ones, sizeof(ones), 1, fn);
+    fclose(fn);
+    EdgeMap padded = load_edge_map(path);
+    BOOST_TEST(padded.count() == 6u);
+    save_edge_map(small, path, EdgeMapEncoding::RLE);
+    uint64_t huge = uint64_t(1) << 62;
+    fn = fopen(path.c_str(), "r+b");
+    fseek(fn, 24, SEEK_SET);
+    fwrite(&huge, sizeof(huge), 1, fn);
+    fclose(fn);
+    BOOST_CHECK_THROW(load_edge_map(path), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_edge_list)
+{
+    Image im = load_image(ROOT_DIR / "data/iguana.jpg");
+    im = rgb_to_grayscale(im);
+    CannyParams params;
+    pair<Image,SectorImage> grad = compute_gradient_sectors(smooth_image(im, params.sigma));
+    Image nms = non_maximum_suppression(grad.first, grad.second);
+    Image dt = double_thresholding(nms, params.low, params.high, params.strong, params.weak);
+    Image edges = edge_tracking(dt, params.weak, params.strong);
+
+    // the list holds the edges of the dense result, in row-major order
+    EdgeMap strong, weak;
+    double_thresholding_into(nms, params.low, params.high, strong, weak);
+    EdgeList list;
+    edge_tracking_into(strong, weak, nms, grad.second, list);
+    BOOST_TEST(list.size() == static_cast<size_t>(std::count(edges.data.begin(), edges.data.end(), params.strong)));
+    BOOST_TEST(list.x.capacity() >= strong.count() + weak.count());
+    bool same = true;
+    size_t k = 0;
+    for (int y = 0; y < edges.h; y++)
+        for (int x = 0; x < edges.w; x++)
+            if (edges(x, y, 0) != 0) {
+                same = same && k < list.size() && list.x[k] == x && list.y[k] == y
+                            && list.magnitude[k] == nms(x, y, 0) && list.magnitude[k] == grad.first(x, y, 0)
+                            && list.sector[k] == grad.second(x, y);
+                k++;
+            }
+    BOOST_TEST(same);
+
+    // sectors rounded from float directions, the whole pipeline
+    pair<Image,Image> grad_float = compute_gradient(smooth_image(im, params.sigma));
+    EdgeList from_float;
+    edge_tracking_into(strong, weak, grad_float.first, grad_float.second, from_float);
+    BOOST_TEST(from_float.x == list.x);
+    BOOST_TEST(from_float.y == list.y);
+    BOOST_TEST(from_float.magnitude == list.magnitude);
+    EdgeList canny = canny_edge_list(im, params);
+    BOOST_TEST(canny.x == list.x);
+    BOOST_TEST(canny.y == list.y);
+    BOOST_TEST(canny.sector == list.sector);
+
+    edge_tracking_into(EdgeMap(8, 2), EdgeMap(8, 2), Image(8, 2, 1), SectorImage(8, 2), list);
+    BOOST_TEST(list.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_load_image_gray)
+{
+    Image rgb = load_image(ROOT_DIR / "data/iguana.jpg");
+    Image gray = load_image_gray(ROOT_DIR / "data/iguana.jpg");
+    BOOST_TEST(gray.c == 1);
+    BOOST_TEST(gray.data == rgb_to_grayscale(rgb).data);
+    ImageU8 gray8 = load_image_gray_u8(ROOT_DIR / "data/iguana.jpg");
+    BOOST_TEST(gray8.data == convert_image<uint8_t>(gray).data);
+
+    // alpha is ignored, gray images keep their channel
+    Image rgba(rgb.w, rgb.h, 4);
+    for (int k = 0; k < 3; k++) rgba.set_channel(k, rgb.get_channel(k));
+    for (int i = 0; i < rgb.w * rgb.h; i++) rgba.data[3 * rgb.w * rgb.h + i] = (i % 7) / 6.0f;
+    rgba.save_png(ROOT_DIR / "output/iguana_rgba");
+    BOOST_TEST(load_image_gray(ROOT_DIR / "output/iguana_rgba.png").data == gray.data);
+    Image smooth = load_image(ROOT_DIR / "data/smooth_iguana.png");
+    BOOST_TEST(load_image_gray(ROOT_DIR / "data/smooth_iguana.png").data == smooth.get_channel(0).data);
+    BOOST_TEST(load_image_gray_u8(ROOT_DIR / "data/smooth_iguana.png").data == convert_image<uint8_t>(smooth.get_channel(0)).data);
+    BOOST_CHECK_THROW(load_image_gray(ROOT_DIR / "data/missing.png"), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(test_frame_stream)
+{
+    Image rgb = load_image(ROOT_DIR / "data/iguana.jpg");
+    std::vector<unsigned char> ppm(rgb.size());
+    const float* planes[3] = {rgb.RowPtr(0, 0).data(), rgb.RowPtr(0, 1).data(), rgb.RowPtr(0, 2).data()};
+    interleave_float_to_u8(planes, rgb.w * rgb.h, 3, ppm.data());
+
+    // a PPM, then a 16-bit PGM of another size, back to back
+    FILE* f = tmpfile();
+    fprintf(f, "P6\n# comment\n%d %d\n255\n", rgb.w, rgb.h);
+    fwrite(ppm.data(), 1, ppm.size(), f);
+    const unsigned char pgm16[] = {0, 0, 0, 250, 3, 232, 1, 244, 0, 1, 255, 255};
+    fprintf(f, "P5 3 2 1000\n");
+    fwrite(pgm16, 1, sizeof(pgm16), f);
+    rewind(f);
+    FrameReader reader(f);
+    Image frame;
+    BOOST_TEST(reader.read(frame));
+    BOOST_TEST((reader.format() == FrameFormat::PPM));
+    BOOST_TEST(frame.data == rgb_to_grayscale(rgb).data);
+    BOOST_TEST(reader.read(frame));
+    BOOST_TEST((reader.format() == FrameFormat::PGM));
+    BOOST_TEST(frame.data == std::vector<float>({0.0f, 250 / 1000.0f, 1.0f, 500 / 1000.0f, 1 / 1000.0f, 1.0f}));
+    BOOST_TEST(!reader.read(frame));
+    BOOST_TEST(reader.frames() == 2);
+    fclose(f);
+
+    // Y4M 4:2:0 with odd sizes: the chroma planes are skipped
+    Image gray = rgb_to_grayscale(rgb);
+    Image edges = canny_fused(gray);
+    f = tmpfile();
+    fprintf(f, "YUV4MPEG2 W5 H3 F30000:1001 It A1:1 C420jpeg XYSCSS=420JPEG\n");
+    for (int i = 0; i < 2; i++) {
+        fprintf(f, "FRAME\n");
+        for (int k = 0; k < 15; k++) fputc(16 * i + k, f);
+        for (int k = 0; k < 2 * 3 * 2; k++) fputc(128, f);
+    }
+    rewind(f);
+    FrameReader y4m(f);
+    BOOST_TEST(y4m.read(frame));
+    BOOST_TEST(y4m.read(frame));
+    BOOST_TEST((y4m.format() == FrameFormat::Y4M));
+    BOOST_TEST(y4m.y4m_params() == "F30000:1001 It A1:1");
+    BOOST_TEST(frame.w == 5);
+    BOOST_TEST(frame(4, 2) == 30 / 255.0f);
+    BOOST_TEST(!y4m.read(frame));
+    fclose(f);
+
+    // edge frames read back
+    for (FrameFormat format : {FrameFormat::PGM, FrameFormat::Y4M}) {
+        f = tmpfile();
+        FrameWriter writer(f, format, "F25:1");
+        writer.write(edges);
+        writer.write(edges);
+        rewind(f);
+        FrameReader back(f);
+        for (int i = 0; i < 2; i++) {
+            BOOST_TEST(back.read(frame));
+            BOOST_TEST(frame.data == edges.data);
+        }
+        BOOST_TEST(!back.read(frame));
+        if (format == FrameFormat::Y4M) BOOST_CHECK_THROW(writer.write(Image(4, 4, 1)), std::runtime_error);
+        fclose(f);
+    }
+    f = tmpfile();
+    FrameWriter(f, FrameFormat::PBM).write(edges);
+    long header = snprintf(nullptr, 0, "P4\n%d %d\n", edges.w, edges.h);
+    BOOST_TEST(ftell(f) == header + (edges.w + 7) / 8 * edges.h);
+    fclose(f);
+
+    // truncated, oversized and malformed frames
+    for (const char* bad : {"P5\n4 4\n255\nabc", "P5 1000000000 1000000000 255\n",
+                            "YUV4MPEG2 W100000 H100000 Cmono\n", "YUV4MPEG2 W99999999999 H2\n", "YUV4MPEG2 W5x H2\n"}) {
+        f = tmpfile();
+        fputs(bad, f);
+        rewind(f);
+        BOOST_CHECK_THROW(FrameReader(f).read(frame), std::runtime_error);
+        fclose(f);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_stage_cache)
+{
+    Image im = load_image(ROOT_DIR / "data/iguana.jpg");
+    im = rgb_to_grayscale(im);
+    CannyParams params;
+    pair<Image,Image> grad = compute_gradient(smooth_image(im, params.sigma));
+    Image nms = non_maximum_suppression(grad.first, grad.second);
+    Image edges = edge_tracking(double_thresholding(nms, params.low, params.high, params.strong, params.weak), params.weak, params.strong);
+
+    // the same edges as the stages, a rerun is served from the cache, new
+    // thresholds rerun only double_thresholding and edge_tracking
+    StageCache cache;
+    string path = (ROOT_DIR / "data/iguana.jpg").string();
+    BOOST_TEST(canny_cached(cache, path, params)->data == edges.data);
+    BOOST_TEST(cache.stats().misses == 6);
+    std::shared_ptr<const Image> again = canny_cached(cache, path, params);
+    BOOST_TEST(again->data == edges.data);
+    BOOST_TEST(cache.stats().hits == 6);
+    params.high = 0.25f;
+    Image higher = edge_tracking(double_thresholding(nms, params.low, params.high, params.strong, params.weak), params.weak, params.strong);
+    BOOST_TEST(canny_cached(cache, path, params)->data == higher.data);
+    BOOST_TEST(cache.stats().hits == 10);
+    BOOST_TEST(cache.stats().misses == 8);
+    BOOST_TEST(cache.stats().entries == 8);
+    BOOST_TEST(canny_cached(cache, im, params)->data == higher.data);
+
+    // content hashes: strided views hash as their copies
+    BOOST_TEST(image_hash(im) == image_hash(Image(im)));
+    BOOST_TEST(image_hash(im.view().roi(3, 5, 100, 80)) == image_hash(Image(im.view().roi(3, 5, 100, 80))));
+    Image changed = im;
+    changed(200, 100) += 1e-6f;
+    BOOST_TEST(image_hash(changed) != image_hash(im));
+    BOOST_TEST(stage_key(1, "stage", {1.0}) != stage_key(1, "stage", {2.0}));
+
+    // least recently used values go first, the bytes stay bounded
+    size_t bytes = cached_bytes(im);
+    StageCache small(2 * bytes);
+    int computed = 0;
+    auto value = [&](uint64_t key) { return small.get<Image>(key, [&] { computed++; return im; }); };
+    value(1);
+    value(2);
+    value(1);
+    value(3);
+    BOOST_TEST(computed == 3);
+    value(1);
+    BOOST_TEST(computed == 3);
+    value(2);
+    BOOST_TEST(computed == 4);
+    BOOST_TEST(small.stats().evictions == 2);
+    BOOST_TEST(small.stats().bytes == 2 * bytes);
+    StageCache tiny(bytes - 1);
+    BOOST_TEST(tiny.get<Image>(1, [&] { return im; })->data == im.data);
+    BOOST_TEST(tiny.stats().entries == 0);
+    BOOST_CHECK_THROW(cache.load_image((ROOT_DIR / "data/missing.png").string()), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(test_parallel_determinism)
+{
+    Image im = load_image(ROOT_DIR / "data/iguana.jpg");
+    im = rgb_to_grayscale(im);
+
+    auto run = [&](int threads) {
+        set_num_threads(threads);
+        Image smooth = smooth_image(im, 1.4);
+        pair<Image,Image> grad = compute_gradient(smooth);
+        Image nms = non_maximum_suppression(grad.first, grad.second);
+        Image dt = double_thresholding(nms, 0.03, 0.17, 1.0, 0.25);
+        return std::vector<Image>{smooth, smooth_image(im, 4), grad.first, grad.second, nms, dt, edge_tracking(dt, 0.25, 1.0)};
+    };
+    std::vector<Image> single = run(1);
+    std::vector<Image> parallel = run(4);
+    set_num_threads(0);
+    for (size_t i = 0; i < single.size(); i++) BOOST_TEST(single[i].data == parallel[i].data);
+}
+
+BOOST_AUTO_TEST_CASE(test_canny_batch)
+{
+    vector<string> paths = {ROOT_DIR / "data/iguana.jpg", ROOT_DIR / "data/smooth_iguana.png", ROOT_DIR / "data/missing.jpg"};
+    BatchStats stats = canny_batch(paths, CannyParams(), ROOT_DIR / "output/batch", 2);
+    BOOST_TEST(stats.images == 2);
+    BOOST_TEST(stats.failed == 1);
+    BOOST_TEST(stats.failed_paths[0] == paths[2]);
+    BOOST_TEST(stats.images_per_second > 0);
+
+    Image edges = load_image(ROOT_DIR / "output/batch/iguana.png");
+    Image et_check = load_image(ROOT_DIR / "data/edge_track_iguana.png");
+    BOOST_TEST(same_image(edges, et_check));
+
+    // written by the PNG encoder, one bit per pixel
+    std::ifstream png(ROOT_DIR / "output/batch/iguana.png", std::ios::binary);
+    char ihdr[25];
+    png.read(ihdr, sizeof(ihdr));
+    BOOST_TEST(int(ihdr[24]) == 1);
+
+    // inputs with the same name do not overwrite each other
+    std::filesystem::create_directories(ROOT_DIR / "output/batch_in");
+    std::filesystem::copy_file(ROOT_DIR / "data/smooth_iguana.png", ROOT_DIR / "output/batch_in/iguana.png",
+                               std::filesystem::copy_options::overwrite_existing);
+    std::filesystem::remove_all(ROOT_DIR / "output/batch_same");
+    paths = {ROOT_DIR / "data/iguana.jpg", ROOT_DIR / "output/batch_in/iguana.png", ROOT_DIR / "data/smooth_iguana.png"};
+    stats = canny_batch(paths, CannyParams(), ROOT_DIR / "output/batch_same", 2);
+    BOOST_TEST(stats.images == 3);
+    BOOST_TEST(same_image(load_image(ROOT_DIR / "output/batch_same/iguana_0.png"), et_check));
+    BOOST_TEST(std::filesystem::exists(ROOT_DIR / "output/batch_same/iguana_1.png"));
+    BOOST_TEST(std::filesystem::exists(ROOT_DIR / "output/batch_same/smooth_iguana.png"));
+    BOOST_TEST(!std::filesystem::exists(ROOT_DIR / "output/batch_same/iguana.png"));
+}
+
+BOOST_AUTO_TEST_CASE(test_auto_thresholds)
+{
+    Image im = load_image(ROOT_DIR / "data/iguana.jpg");
+    im = rgb_to_grayscale(im);
+    Image smooth = smooth_image(im, 1.4);
+    pair<Image,Image> grad = compute_gradient(smooth);
+
+    MagnitudeHistogram hist;
+    Image nms = non_maximum_suppression(grad.first, grad.second, hist);
+    BOOST_TEST(nms.data == non_maximum_suppression(grad.first, grad.second).data);
+    uint64_t nonzero = 0;
+    for (float v : nms.data) if (v > 0) nonzero++;
+    BOOST_TEST(hist.total == nonzero);
+
+    for (ThresholdMethod method : {ThresholdMethod::Median, ThresholdMethod::Otsu}) {
+        auto [low, high] = auto_thresholds(hist, method);
+        BOOST_TEST(low > 0);
+        BOOST_TEST(low < high);
+        BOOST_TEST(high <= 1);
+
+        // the fused engine picks the same thresholds
+        CannyParams params;
+        params.thresholds = method;
+        Image dt = double_thresholding(nms, low, high, params.strong, params.weak);
+        Image staged = edge_tracking(dt, params.weak, params.strong);
+        BOOST_TEST(canny_fused(im, params).data == staged.data);
+    }
+
+    // all the magnitudes in one bin: no Otsu split, the edges of a step stay thin
+    MagnitudeHistogram single;
+    for (int i = 0; i < 100; i++) single.add(0.6f);
+    for (ThresholdMethod method : {ThresholdMethod::Median, ThresholdMethod::Otsu}) {
+        auto [low, high] = auto_thresholds(single, method);
+        BOOST_TEST(high > 0);
+        BOOST_TEST(low <= high);
+        BOOST_TEST(high <= 1);
+    }
+    Image step(64, 64, 1);
+    for (int y = 0; y < 64; y++)
+        for (int x = 32; x < 64; x++) step(x, y, 0) = 1;
+    CannyParams params;
+    params.thresholds = ThresholdMethod::Otsu;
+    Image edges = canny_fused(step, params);
+    size_t count = std::count(edges.data.begin(), edges.data.end(), params.strong);
+    BOOST_TEST(count > 0);
+    BOOST_TEST(count <= 2 * 64);
+}
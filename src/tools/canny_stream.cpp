@@ -0,0 +1,161 @@
+// Canny edge detection over a stream of frames, for shell pipelines.
+//
+// canny_stream [--sigma S] [--low L] [--high H] [--thresholds manual|median|otsu]
+//              [--format pgm|pbm|y4m] [--threads N] [--quiet]
+//
+// Reads concatenated binary PGM/PPM frames or a YUV4MPEG2 stream on stdin
+// (see frame_stream.h), runs canny_fused() on each frame, reusing the frame
+// and edge buffers, and writes the edge frames on stdout: Y4M for a Y4M
+// input, PGM otherwise, unless --format says otherwise. The read, Canny and
+// write times of each frame go to stderr, followed by their median, 95th
+// percentile and maximum over the stream. For example
+//
+//   ffmpeg -i video.mp4 -f yuv4mpegpipe - | canny_stream | ffmpeg -i - edges.mp4
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "image.h"
+#include "frame_stream.h"
+#include "parallel.h"
+
+using namespace std;
+
+struct Options
+  {
+  CannyParams params;
+  string format;
+  int threads = 0;
+  bool quiet = false;
+  };
+
+[[noreturn]] static void usage(void)
+{
+    fprintf(stderr, "usage: canny_stream [--sigma S] [--low L] [--high H] [--thresholds manual|median|otsu]\n"
+                    "                    [--format pgm|pbm|y4m] [--threads N] [--quiet]\n");
+    exit(1);
+}
+
+static Options parse_options(int argc, char** argv)
+{
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        auto value = [&]() -> string {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Missing value for %s\n", arg.c_str());
+                exit(1);
+            }
+            return argv[++i];
+        };
+        // stof and stoi throw on a value that is not a number or out of range
+        auto number = [&](auto parse) {
+            string v = value();
+            try {
+                return parse(v);
+            } catch (const logic_error&) {
+                fprintf(stderr, "Invalid value %s for %s\n", v.c_str(), arg.c_str());
+                usage();
+            }
+        };
+        auto to_float = [](const string& v) { return stof(v); };
+        auto to_int = [](const string& v) { return stoi(v); };
+        if (arg == "--sigma") opt.params.sigma = number(to_float);
+        else if (arg == "--low") opt.params.low = number(to_float);
+        else if (arg == "--high") opt.params.high = number(to_float);
+        else if (arg == "--thresholds") {
+            string method = value();
+            if (method == "manual") opt.params.thresholds = ThresholdMethod::Manual;
+            else if (method == "median") opt.params.thresholds = ThresholdMethod::Median;
+            else if (method == "otsu") opt.params.thresholds = ThresholdMethod::Otsu;
+            else {
+                fprintf(stderr, "Unknown threshold method %s\n", method.c_str());
+                exit(1);
+            }
+        }
+        else if (arg == "--format") {
+            opt.format = value();
+            if (opt.format != "pgm" && opt.format != "pbm" && opt.format != "y4m") {
+                fprintf(stderr, "Unknown output format %s\n", opt.format.c_str());
+                exit(1);
+            }
+        }
+        else if (arg == "--threads") opt.threads = number(to_int);
+        else if (arg == "--quiet") opt.quiet = true;
+        else {
+            fprintf(stderr, "Unknown option %s\n", arg.c_str());
+            usage();
+        }
+    }
+    return opt;
+}
+
+static void print_stats(const char* stage, vector<double> ms)
+{
+    if (ms.empty()) return;
+    sort(ms.begin(), ms.end());
+    size_t n = ms.size();
+    double median = n % 2 ? ms[n / 2] : 0.5 * (ms[n / 2 - 1] + ms[n / 2]);
+    double p95 = ms[min(n - 1, static_cast<size_t>(0.95 * n))];
+    fprintf(stderr, "%-8s median %8.3f ms  p95 %8.3f ms  max %8.3f ms\n", stage, median, p95, ms.back());
+}
+
+int main(int argc, char** argv)
+{
+    Options opt = parse_options(argc, argv);
+    set_num_threads(opt.threads);
+
+    FrameReader reader(stdin);
+    Image frame, edges;
+    optional<FrameWriter> writer;
+    vector<double> read_ms, canny_ms, write_ms, total_ms;
+    auto elapsed = [](chrono::steady_clock::time_point since) {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - since).count();
+    };
+
+    auto start = chrono::steady_clock::now();
+    try {
+        for (;;) {
+            auto t0 = chrono::steady_clock::now();
+            if (!reader.read(frame)) break;
+            auto t1 = chrono::steady_clock::now();
+            canny_fused_into(frame, opt.params, edges);
+            auto t2 = chrono::steady_clock::now();
+            if (!writer) {
+                // the output format follows the input unless set
+                FrameFormat format = reader.format() == FrameFormat::Y4M ? FrameFormat::Y4M : FrameFormat::PGM;
+                if (opt.format == "pgm") format = FrameFormat::PGM;
+                else if (opt.format == "pbm") format = FrameFormat::PBM;
+                else if (opt.format == "y4m") format = FrameFormat::Y4M;
+                writer.emplace(stdout, format, reader.y4m_params());
+            }
+            writer->write(edges);
+
+            read_ms.push_back(chrono::duration<double, milli>(t1 - t0).count());
+            canny_ms.push_back(chrono::duration<double, milli>(t2 - t1).count());
+            write_ms.push_back(elapsed(t2));
+            total_ms.push_back(elapsed(t0));
+            if (!opt.quiet)
+                fprintf(stderr, "frame %d %dx%d: read %.3f ms, canny %.3f ms, write %.3f ms\n", reader.frames(),
+                        frame.w, frame.h, read_ms.back(), canny_ms.back(), write_ms.back());
+        }
+    } catch (const exception& e) {
+        fprintf(stderr, "canny_stream: %s, after %d frames\n", e.what(), reader.frames());
+        return 1;
+    }
+
+    double seconds = elapsed(start) / 1e3;
+    fprintf(stderr, "%d frames in %.3f s (%.1f frames/s)\n", reader.frames(), seconds,
+            seconds > 0 ? reader.frames() / seconds : 0.0);
+    print_stats("read", read_ms);
+    print_stats("canny", canny_ms);
+    print_stats("write", write_ms);
+    print_stats("total", total_ms);
+    return 0;
+}